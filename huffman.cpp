@@ -0,0 +1,2588 @@
+/*
+ * File: huffman.cpp
+ * Description: Implementation of the Huffman encoding library declared in
+ *     huffman.h.
+ */
+
+#include "huffman.h"
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+using namespace std;
+
+/*
+ * description: finds the time since start and moves start to now, so
+ *              consecutive calls time consecutive phases
+ * return: seconds since start
+ * precondition: start was set by steady_clock::now or a previous call
+ * postcondition: start is the current time
+ *
+*/
+
+static double lap(chrono::steady_clock::time_point& start) {
+    chrono::steady_clock::time_point now = chrono::steady_clock::now(); //end of the phase
+    double seconds = chrono::duration<double>(now - start).count(); //length of the phase
+    start = now;
+    return seconds;
+}
+
+/*
+ * description: default constructor for the stats
+ * return: none
+ * precondition: none
+ * postcondition: every counter and timing is zero
+ *
+*/
+
+huff_stats::huff_stats() {
+    memset(this, 0, sizeof(*this));
+}
+
+/*
+ * description: adds the counters and timings of other, such as the stats of
+ *              another thread's encoder
+ * return: void (N/A)
+ * precondition: none
+ * postcondition: sums are added, maxCodeLen and peakMemoryKB keep the larger
+ *
+*/
+
+void huff_stats::add(const huff_stats& other) {
+    readSeconds += other.readSeconds;
+    histogramSeconds += other.histogramSeconds;
+    buildSeconds += other.buildSeconds;
+    headerSeconds += other.headerSeconds;
+    encodeSeconds += other.encodeSeconds;
+    flushSeconds += other.flushSeconds;
+    totalSeconds += other.totalSeconds;
+    bytesIn += other.bytesIn;
+    bytesOut += other.bytesOut;
+    blocks += other.blocks;
+    reusedTables += other.reusedTables;
+    storedBlocks += other.storedBlocks;
+    codedBits += other.codedBits;
+    for (int i = 0; i < 256; i++) {
+        freq[i] += other.freq[i];
+    }
+    maxCodeLen = max(maxCodeLen, other.maxCodeLen);
+    peakMemoryKB = max(peakMemoryKB, other.peakMemoryKB);
+}
+
+/*
+ * description: finds the Shannon entropy of the encoded characters, the
+ *              fewest bits per character any order-0 code could reach
+ * return: entropy in bits per character, 0 if nothing was encoded
+ * precondition: none
+ * postcondition: the stats are unchanged
+ *
+*/
+
+double huff_stats::entropy() const {
+    uint64_t total = 0; //number of encoded characters
+    double bits = 0; //entropy being summed
+
+    for (int i = 0; i < 256; i++) {
+        total += freq[i];
+    }
+    for (int i = 0; i < 256; i++) {
+        if (freq[i] != 0) {
+            double p = (double)freq[i] / total; //probability of the character
+            bits -= p * log2(p);
+        }
+    }
+    return bits;
+}
+
+/*
+ * description: formats the stats as "stats <key>=<value>" lines, one value
+ *              per line, so scripts can pick out the values they watch
+ * return: the formatted lines
+ * precondition: none
+ * postcondition: the stats are unchanged
+ *
+*/
+
+string huff_stats::toLines() const {
+    uint64_t symbols = 0; //number of encoded characters
+    int distinct = 0; //number of different encoded characters
+    char line[128]; //one formatted line
+    string lines; //the lines being built
+
+    for (int i = 0; i < 256; i++) {
+        symbols += freq[i];
+        distinct += freq[i] != 0;
+    }
+    double seconds = max(totalSeconds, 1e-9); //wall time, never zero
+
+    const struct {
+        const char* key;
+        double value;
+    } timings[] = {{"read_seconds", readSeconds}, {"histogram_seconds", histogramSeconds},
+                   {"build_seconds", buildSeconds}, {"header_seconds", headerSeconds},
+                   {"encode_seconds", encodeSeconds}, {"flush_seconds", flushSeconds},
+                   {"total_seconds", totalSeconds}};
+    for (size_t i = 0; i < sizeof(timings) / sizeof(timings[0]); i++) {
+        snprintf(line, sizeof(line), "stats %s=%.6f\n", timings[i].key, timings[i].value);
+        lines += line;
+    }
+
+    snprintf(line, sizeof(line), "stats bytes_in=%llu\nstats bytes_out=%llu\n",
+             (unsigned long long)bytesIn, (unsigned long long)bytesOut);
+    lines += line;
+    snprintf(line, sizeof(line), "stats ratio=%.4f\nstats mb_per_s=%.2f\n",
+             bytesIn ? (double)bytesOut / bytesIn : 0.0, max(bytesIn, bytesOut) / seconds / 1e6);
+    lines += line;
+    snprintf(line, sizeof(line), "stats blocks=%llu\nstats reused_tables=%llu\n",
+             (unsigned long long)blocks, (unsigned long long)reusedTables);
+    lines += line;
+    snprintf(line, sizeof(line), "stats stored_blocks=%llu\n", (unsigned long long)storedBlocks);
+    lines += line;
+    snprintf(line, sizeof(line), "stats symbols=%llu\nstats distinct_symbols=%d\n",
+             (unsigned long long)symbols, distinct);
+    lines += line;
+    snprintf(line, sizeof(line), "stats entropy_bits_per_symbol=%.4f\n", entropy());
+    lines += line;
+    //the compressed side is the smaller one, -huff doesn't keep larger files
+    uint64_t compressed = min(bytesIn, bytesOut); //bytes of the compressed file
+    snprintf(line, sizeof(line), "stats coded_bits_per_symbol=%.4f\nstats file_bits_per_symbol=%.4f\n",
+             symbols ? (double)codedBits / symbols : 0.0, symbols ? 8.0 * compressed / symbols : 0.0);
+    lines += line;
+    snprintf(line, sizeof(line), "stats max_code_len=%d\nstats peak_memory_kb=%ld\n",
+             maxCodeLen, peakMemoryKB);
+    lines += line;
+    return lines;
+}
+
+/*
+ * description: finds the length of every character's code with a Huffman
+ *              tree stored in a flat array. Leaves are sorted by frequency
+ *              and merged with the two-queue method, so equal frequencies
+ *              always produce the same lengths. Codes longer than maxLen are
+ *              shortened and the lengths rebalanced so they still form a
+ *              complete prefix code. Counts of any size work, the largest
+ *              are scaled below 2^maxWeightBits first.
+ * return: void (N/A)
+ * precondition: freq has 256 entries with at least one nonzero frequency,
+ *               lengths has 256 entries, maxLen is at most maxCodeLen and
+ *               2^maxLen is at least the number of used characters
+ * postcondition: no return, but lengths holds the code length of every
+ *                character, 0 for characters with a zero frequency
+ *
+*/
+
+void buildCodeLengths(const uint64_t freq[256], unsigned char lengths[256], int maxLen) {
+    int leaves[256]; //used characters, sorted by frequency
+    int numLeaves = 0; //number of used characters
+
+    for (int i = 0; i < 256; i++) {
+        lengths[i] = 0;
+        if (freq[i] != 0) {
+            leaves[numLeaves++] = i;
+        }
+    }
+
+    //a single character still needs a one bit code
+    if (numLeaves == 1) {
+        lengths[leaves[0]] = 1;
+        return;
+    }
+
+    //sort by frequency, ties broken by the character itself
+    sort(leaves, leaves + numLeaves, [&](int a, int b) {
+        return freq[a] != freq[b] ? freq[a] < freq[b] : a < b;
+    });
+
+    //nodes 0..numLeaves-1 are the leaves in sorted order, internal nodes
+    //follow in the order they are created, which is also sorted by weight
+    uint64_t weight[511]; //weight of every node
+    int parent[511]; //index of every node's parent
+    int numNodes = 2 * numLeaves - 1; //number of nodes in the tree
+    int nextLeaf = 0; //first leaf not yet merged
+    int nextNode = numLeaves; //first internal node not yet merged
+
+    //counts of huge inputs are scaled down so the root's weight can't
+    //overflow, the order is kept and no used character drops to zero
+    uint64_t largest = freq[leaves[numLeaves - 1]]; //highest frequency
+    int shift = max(0, 64 - __builtin_clzll(largest) - maxWeightBits); //bits
+    //the counts are scaled down by
+    for (int i = 0; i < numLeaves; i++) {
+        weight[i] = max((uint64_t)1, freq[leaves[i]] >> shift);
+    }
+
+    //merge the two lightest nodes from the front of either queue
+    for (int i = numLeaves; i < numNodes; i++) {
+        int pick[2]; //the two nodes merged into node i
+        for (int k = 0; k < 2; k++) {
+            if (nextLeaf < numLeaves && (nextNode == i || weight[nextLeaf] <= weight[nextNode])) {
+                pick[k] = nextLeaf++;
+            }
+            else {
+                pick[k] = nextNode++;
+            }
+        }
+        weight[i] = weight[pick[0]] + weight[pick[1]];
+        parent[pick[0]] = i;
+        parent[pick[1]] = i;
+    }
+
+    //depth of each node is one more than its parent, the root is last
+    int depth[511]; //depth of every node
+    int lengthCount[64] = {}; //number of leaves at each depth
+    int maxDepth = 0; //deepest leaf
+    depth[numNodes - 1] = 0;
+    for (int i = numNodes - 2; i >= 0; i--) {
+        depth[i] = depth[parent[i]] + 1;
+    }
+    for (int i = 0; i < numLeaves; i++) {
+        lengthCount[depth[i]]++;
+        maxDepth = max(maxDepth, depth[i]);
+    }
+
+    //move leaves deeper than maxLen up to maxLen, then lengthen the
+    //deepest codes shorter than maxLen until the code is complete again
+    if (maxDepth > maxLen) {
+        uint64_t total = 0; //sum of 2^(maxLen - length) over every leaf
+        for (int len = maxLen + 1; len <= maxDepth; len++) {
+            lengthCount[maxLen] += lengthCount[len];
+            lengthCount[len] = 0;
+        }
+        for (int len = 1; len <= maxLen; len++) {
+            total += (uint64_t)lengthCount[len] << (maxLen - len);
+        }
+        while (total > (1ull << maxLen)) {
+            lengthCount[maxLen]--;
+            for (int len = maxLen - 1; len > 0; len--) {
+                if (lengthCount[len] != 0) {
+                    lengthCount[len]--;
+                    lengthCount[len + 1] += 2;
+                    break;
+                }
+            }
+            total--;
+        }
+        maxDepth = maxLen;
+    }
+
+    //the most frequent characters get the shortest lengths
+    int leaf = numLeaves - 1; //next leaf to give a length, most frequent first
+    for (int len = 1; len <= maxDepth; len++) {
+        for (int i = 0; i < lengthCount[len]; i++) {
+            lengths[leaves[leaf--]] = len;
+        }
+    }
+}
+
+/*
+ * description: assigns canonical codes from the code lengths. Codes of the
+ *              same length are consecutive in character order, and each
+ *              length starts right after the codes of the previous length,
+ *              so the lengths alone are enough to rebuild every code.
+ * return: void (N/A)
+ * precondition: lengths has 256 entries, each at most maxCodeLen
+ * postcondition: every member of the canonical code is filled in
+ *
+*/
+
+void canonical_code::assign(const unsigned char newLengths[256]) {
+    int nextCode = 0; //first code of the current length
+
+    numSyms = 0;
+    memset(count, 0, sizeof(count));
+    for (int i = 0; i < 256; i++) {
+        lengths[i] = newLengths[i];
+        count[lengths[i]]++;
+        codes[i].bits = 0;
+        codes[i].len = 0;
+    }
+    count[0] = 0;
+
+    //first code and first sorted index of every length
+    for (int len = 1; len <= maxCodeLen; len++) {
+        nextCode = (nextCode + count[len - 1]) << 1;
+        firstCode[len] = nextCode;
+        firstIndex[len] = numSyms;
+        numSyms += count[len];
+    }
+
+    //hand out the codes in (length, character) order
+    int fill[maxCodeLen + 1]; //next sorted index of each length
+    memcpy(fill, firstIndex, sizeof(fill));
+    for (int i = 0; i < 256; i++) {
+        int len = lengths[i];
+        if (len != 0) {
+            codes[i].bits = firstCode[len] + (fill[len] - firstIndex[len]);
+            codes[i].len = len;
+            sorted[fill[len]++] = i;
+        }
+    }
+}
+
+/*
+ * description: fills the decode table from a canonical code. Codes of at
+ *              most lookupBits bits fill every slot that starts with them,
+ *              slots of longer codes are left with length 0 so decoding
+ *              falls back to searching the code lengths above lookupBits.
+ * return: void (N/A)
+ * precondition: code was filled by assign, table has (1 << lookupBits) entries
+ * postcondition: no return, but table will hold an entry for every slot
+ *
+*/
+
+void buildDecodeTable(const canonical_code& code, decode_entry* table) {
+    for (int i = 0; i < (1 << lookupBits); i++) {
+        table[i].sub = -1;
+        table[i].sym = 0;
+        table[i].len = 0;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        int len = code.lengths[i];
+        if (len != 0 && len <= lookupBits) {
+            unsigned int first = code.codes[i].bits << (lookupBits - len);
+            unsigned int count = 1u << (lookupBits - len);
+            for (unsigned int k = 0; k < count; k++) {
+                table[first + k].sym = i;
+                table[first + k].len = len;
+            }
+        }
+    }
+}
+
+/*
+ * description: picks the index bits of a multi-symbol table for a code:
+ *              codes of at most 5 bits get a 10-bit table (8 KiB, at least
+ *              2 characters per lookup), longer ones a 12-bit table (32 KiB),
+ *              both small enough to stay in the L1 cache
+ * return: 10 or 12, or 0 if the code uses more than smallAlphabet characters
+ *         or has codes longer than maxMultiBits
+ * precondition: code was built by assign
+ * postcondition: none
+ *
+*/
+
+int multiTableBits(const canonical_code& code) {
+    int longest = 0; //longest code length
+    for (int len = 1; len <= maxCodeLen; len++) {
+        if (code.count[len] != 0) {
+            longest = len;
+        }
+    }
+    if (code.numSyms > smallAlphabet || longest > maxMultiBits) {
+        return 0;
+    }
+    return longest <= 5 ? 10 : 12;
+}
+
+/*
+ * description: builds a multi-symbol decode table: the entry of every
+ *              tableBits-bit value holds each whole code at its start, up to
+ *              maxMultiSyms of them, found by checking the codes of each
+ *              length in turn as decodeSymbol does
+ * return: void (N/A)
+ * precondition: multiTableBits(code) returned tableBits, multi has
+ *               2^tableBits entries
+ * postcondition: multi holds the decoded characters of every value
+ *
+*/
+
+void buildMultiTable(const canonical_code& code, int tableBits, multi_entry* multi) {
+    for (uint32_t i = 0; i < (1u << tableBits); i++) {
+        multi_entry& e = multi[i]; //entry of the value i
+        int used = 0; //bits of i used by the codes so far
+        bool found = true; //true while another code fits
+
+        memset(&e, 0, sizeof(e));
+        while (found && e.count < maxMultiSyms) {
+            found = false;
+            for (int len = 1; len <= tableBits - used && !found; len++) {
+                int offset = (int)((i >> (tableBits - used - len)) & ((1u << len) - 1)) -
+                             code.firstCode[len];
+                if (offset >= 0 && offset < code.count[len]) {
+                    e.syms[e.count++] = code.sorted[code.firstIndex[len] + offset];
+                    used += len;
+                    found = true;
+                }
+            }
+        }
+        e.bits = used;
+    }
+}
+
+/*
+ * description: decodes the code at the start of bitBuf with one table
+ *              lookup, codes longer than lookupBits are found by checking
+ *              the codes of each longer length in turn
+ * return: length of the code, more than maxCodeLen if no code matches
+ * precondition: the code starts at the highest bit of bitBuf
+ * postcondition: ch holds the decoded character if a code matched
+ *
+*/
+
+static inline int decodeSymbol(const canonical_code& code, const decode_entry* table,
+                               uint64_t bitBuf, char& ch) {
+    const decode_entry& e = table[bitBuf >> (64 - lookupBits)];
+    int len = e.len; //length of the decoded code
+
+    ch = e.sym;
+    if (len == 0) {
+        for (len = lookupBits + 1; len <= maxCodeLen; len++) {
+            int offset = (int)(bitBuf >> (64 - len)) - code.firstCode[len];
+            if (offset >= 0 && offset < code.count[len]) {
+                ch = code.sorted[code.firstIndex[len] + offset];
+                break;
+            }
+        }
+    }
+    return len;
+}
+
+/*
+ * description: decodes count characters spread over numStreams interleaved
+ *              bitstreams, character i coming from stream i % numStreams.
+ *              The streams are decoded in lockstep, so the lookups of
+ *              different streams don't depend on each other and can run at
+ *              the same time. Most characters are decoded in a bulk phase
+ *              that loads 8 bytes of every stream at a time and decodes
+ *              three codes per stream per load without end checks, the last
+ *              few in a careful phase that loads a byte at a time and checks
+ *              every code against the bits left.
+ * return: true if count characters were decoded, false if a stream ran out
+ *         or held bits that are not a code
+ * precondition: table was built from code by buildDecodeTable, stream s
+ *               holds sizes[s] bytes, dest has room for count characters
+ * postcondition: the decoded characters are written to dest
+ *
+*/
+
+template <int numStreams>
+static bool decodeInterleaved(const canonical_code& code, const decode_entry* table,
+                              const unsigned char* const* streams, const size_t* sizes,
+                              size_t count, char* dest) {
+    uint64_t bitBuf[numStreams] = {}; //bits waiting to be decoded in each stream,
+    //bits after the first bitCount are the following bits of the stream or zero
+    int bitCount[numStreams] = {}; //number of valid bits in each bitBuf
+    size_t pos[numStreams] = {}; //next byte of each stream to load
+    size_t n = 0; //number of decoded characters
+
+    //bulk phase, a refill leaves at least 56 bits, enough for 3 codes
+    while (count - n >= 3 * numStreams) {
+        bool room = true; //true if every stream has 8 bytes left to load
+        for (int s = 0; s < numStreams; s++) {
+            room &= sizes[s] - pos[s] >= 8;
+        }
+        if (!room) {
+            break;
+        }
+
+        for (int s = 0; s < numStreams; s++) {
+            uint64_t word; //next 8 bytes of the stream
+            memcpy(&word, streams[s] + pos[s], sizeof(word));
+            bitBuf[s] |= __builtin_bswap64(word) >> bitCount[s];
+            pos[s] += (63 - bitCount[s]) >> 3;
+            bitCount[s] |= 56;
+        }
+
+        for (int k = 0; k < 3; k++) {
+            for (int s = 0; s < numStreams; s++) {
+                int len = decodeSymbol(code, table, bitBuf[s], dest[n++]);
+                if (len > maxCodeLen) {
+                    return false;
+                }
+                bitBuf[s] <<= len;
+                bitCount[s] -= len;
+            }
+        }
+    }
+
+    //careful phase, n is a multiple of numStreams when it starts
+    for (int s = 0; n < count; n++, s = (s + 1 == numStreams) ? 0 : s + 1) {
+        while (bitCount[s] <= 56 && pos[s] < sizes[s]) {
+            bitBuf[s] |= (uint64_t)streams[s][pos[s]++] << (56 - bitCount[s]);
+            bitCount[s] += 8;
+        }
+
+        int len = decodeSymbol(code, table, bitBuf[s], dest[n]);
+        if (len > maxCodeLen || len > bitCount[s]) {
+            return false;
+        }
+        bitBuf[s] <<= len;
+        bitCount[s] -= len;
+    }
+    return true;
+}
+
+/*
+ * description: decodes exactly count characters of a canonical encoding
+ *              split over numStreams interleaved bitstreams
+ * return: true if count characters were decoded, false if the streams ran
+ *         out, held bits that are not a code, or numStreams is not between
+ *         1 and maxStreams
+ * precondition: table was built from code by buildDecodeTable, stream s
+ *               holds sizes[s] bytes
+ * postcondition: the decoded characters are appended to out, nothing is
+ *                appended if decoding failed
+ *
+*/
+
+bool decodeStreams(const canonical_code& code, const decode_entry* table,
+                   const unsigned char* const* streams, const size_t* sizes,
+                   int numStreams, size_t count, string& out) {
+    size_t start = out.size(); //position of the decoded characters in out
+    bool valid = false; //true if every character was decoded
+
+    out.resize(start + count);
+    char* dest = &out[start]; //where the decoded characters go
+
+    //the stream count is fixed at compile time so each stream's state can
+    //live in registers
+    switch (numStreams) {
+        case 1: valid = decodeInterleaved<1>(code, table, streams, sizes, count, dest); break;
+        case 2: valid = decodeInterleaved<2>(code, table, streams, sizes, count, dest); break;
+        case 3: valid = decodeInterleaved<3>(code, table, streams, sizes, count, dest); break;
+        case 4: valid = decodeInterleaved<4>(code, table, streams, sizes, count, dest); break;
+        case 5: valid = decodeInterleaved<5>(code, table, streams, sizes, count, dest); break;
+        case 6: valid = decodeInterleaved<6>(code, table, streams, sizes, count, dest); break;
+        case 7: valid = decodeInterleaved<7>(code, table, streams, sizes, count, dest); break;
+        case 8: valid = decodeInterleaved<8>(code, table, streams, sizes, count, dest); break;
+    }
+    if (!valid) {
+        out.resize(start);
+    }
+    return valid;
+}
+
+/*
+ * description: decodes exactly count characters of a canonical encoding held
+ *              in a single bitstream
+ * return: true if count characters were decoded, false if the data ran out
+ *         or held bits that are not a code
+ * precondition: table was built from code by buildDecodeTable, data holds
+ *               size bytes
+ * postcondition: the decoded characters are appended to out, nothing is
+ *                appended if decoding failed
+ *
+*/
+
+bool decodeData(const canonical_code& code, const decode_entry* table,
+                const unsigned char* data, size_t size, size_t count, string& out) {
+    return decodeStreams(code, table, &data, &size, 1, count, out);
+}
+
+/*
+ * description: decodes count characters spread over numStreams interleaved
+ *              bitstreams with a multi-symbol table, character i coming from
+ *              stream i % numStreams. The index bits are fixed at compile
+ *              time, so the bulk phase does 56 / tableBits lookups per
+ *              stream per refill, each writing all maxMultiSyms characters
+ *              of its entry and advancing by the number that were decoded.
+ *              The last few characters of each stream are decoded one at a
+ *              time with the single-symbol table.
+ * return: true if count characters were decoded, false if a stream ran out
+ *         or held bits that are not a code
+ * precondition: multi was built from code by buildMultiTable with
+ *               tableBits, table from code by buildDecodeTable, stream s
+ *               holds sizes[s] bytes, dest has room for count characters
+ * postcondition: the decoded characters are written to dest
+ *
+*/
+
+template <int numStreams, int tableBits>
+static bool decodeMulti(const canonical_code& code, const decode_entry* table,
+                        const multi_entry* multi, const unsigned char* const* streams,
+                        const size_t* sizes, size_t count, char* dest) {
+    const int lookups = 56 / tableBits; //lookups per stream per refill
+    uint64_t bitBuf[numStreams] = {}; //bits waiting to be decoded in each stream
+    int bitCount[numStreams] = {}; //number of valid bits in each bitBuf
+    size_t pos[numStreams] = {}; //next byte of each stream to load
+    size_t done[numStreams] = {}; //number of decoded characters of each stream
+    size_t total[numStreams]; //number of characters in each stream
+
+    for (int s = 0; s < numStreams; s++) {
+        total[s] = count > (size_t)s ? (count - s + numStreams - 1) / numStreams : 0;
+    }
+
+    //bulk phase, a refill leaves at least 56 bits, enough for every lookup
+    for (;;) {
+        bool room = true; //true if every stream has 8 bytes and room for every lookup
+        for (int s = 0; s < numStreams; s++) {
+            room &= sizes[s] - pos[s] >= 8 && total[s] - done[s] >= lookups * maxMultiSyms;
+        }
+        if (!room) {
+            break;
+        }
+
+        for (int s = 0; s < numStreams; s++) {
+            uint64_t word; //next 8 bytes of the stream
+            memcpy(&word, streams[s] + pos[s], sizeof(word));
+            bitBuf[s] |= __builtin_bswap64(word) >> bitCount[s];
+            pos[s] += (63 - bitCount[s]) >> 3;
+            bitCount[s] |= 56;
+        }
+
+        for (int k = 0; k < lookups; k++) {
+            for (int s = 0; s < numStreams; s++) {
+                const multi_entry& e = multi[bitBuf[s] >> (64 - tableBits)]; //the decoded chars
+                if (e.count == 0) {
+                    return false;
+                }
+                char* out = dest + s + numStreams * done[s]; //where the chars go
+                for (int m = 0; m < maxMultiSyms; m++) {
+                    out[numStreams * m] = e.syms[m];
+                }
+                done[s] += e.count;
+                bitBuf[s] <<= e.bits;
+                bitCount[s] -= e.bits;
+            }
+        }
+    }
+
+    //careful phase, each stream is finished on its own
+    for (int s = 0; s < numStreams; s++) {
+        for (; done[s] < total[s]; done[s]++) {
+            while (bitCount[s] <= 56 && pos[s] < sizes[s]) {
+                bitBuf[s] |= (uint64_t)streams[s][pos[s]++] << (56 - bitCount[s]);
+                bitCount[s] += 8;
+            }
+
+            int len = decodeSymbol(code, table, bitBuf[s], dest[s + numStreams * done[s]]);
+            if (len > maxCodeLen || len > bitCount[s]) {
+                return false;
+            }
+            bitBuf[s] <<= len;
+            bitCount[s] -= len;
+        }
+    }
+    return true;
+}
+
+/*
+ * description: runs decodeMulti with the stream count fixed at compile time
+ * return: the result of decodeMulti, false if numStreams is not between 1
+ *         and maxStreams
+ * precondition: as for decodeMulti
+ * postcondition: as for decodeMulti
+ *
+*/
+
+template <int tableBits>
+static bool decodeMultiBits(const canonical_code& code, const decode_entry* table,
+                            const multi_entry* multi, const unsigned char* const* streams,
+                            const size_t* sizes, int numStreams, size_t count, char* dest) {
+    switch (numStreams) {
+        case 1: return decodeMulti<1, tableBits>(code, table, multi, streams, sizes, count, dest);
+        case 2: return decodeMulti<2, tableBits>(code, table, multi, streams, sizes, count, dest);
+        case 3: return decodeMulti<3, tableBits>(code, table, multi, streams, sizes, count, dest);
+        case 4: return decodeMulti<4, tableBits>(code, table, multi, streams, sizes, count, dest);
+        case 5: return decodeMulti<5, tableBits>(code, table, multi, streams, sizes, count, dest);
+        case 6: return decodeMulti<6, tableBits>(code, table, multi, streams, sizes, count, dest);
+        case 7: return decodeMulti<7, tableBits>(code, table, multi, streams, sizes, count, dest);
+        case 8: return decodeMulti<8, tableBits>(code, table, multi, streams, sizes, count, dest);
+    }
+    return false;
+}
+
+/*
+ * description: decodes exactly count characters of a canonical encoding
+ *              split over numStreams interleaved bitstreams with a
+ *              multi-symbol table, the fast path of decodeStreams for small
+ *              alphabets
+ * return: true if count characters were decoded, false if the streams ran
+ *         out, held bits that are not a code, numStreams is not between 1
+ *         and maxStreams or tableBits is not 10 or 12
+ * precondition: multi was built from code by buildMultiTable with
+ *               tableBits, table from code by buildDecodeTable, stream s
+ *               holds sizes[s] bytes
+ * postcondition: the decoded characters are appended to out, nothing is
+ *                appended if decoding failed
+ *
+*/
+
+bool decodeMultiStreams(const canonical_code& code, const decode_entry* table,
+                        const multi_entry* multi, int tableBits,
+                        const unsigned char* const* streams, const size_t* sizes,
+                        int numStreams, size_t count, string& out) {
+    size_t start = out.size(); //position of the decoded characters in out
+    bool valid = false; //true if every character was decoded
+
+    out.resize(start + count);
+    char* dest = &out[start]; //where the decoded characters go
+    if (tableBits == 10) {
+        valid = decodeMultiBits<10>(code, table, multi, streams, sizes, numStreams, count, dest);
+    }
+    else if (tableBits == 12) {
+        valid = decodeMultiBits<12>(code, table, multi, streams, sizes, numStreams, count, dest);
+    }
+    if (!valid) {
+        out.resize(start);
+    }
+    return valid;
+}
+
+/*
+ * description: decodes count characters of an order-1 block. Stream s holds
+ *              the s-th of numStreams consecutive segments of the block, and
+ *              each character is decoded with the code of the cluster of the
+ *              character before it, 0 at the start of a segment. Each
+ *              segment only waits on its own characters, so the streams are
+ *              still decoded in lockstep, with the same bulk and careful
+ *              phases as decodeInterleaved.
+ * return: true if count characters were decoded, false if a stream ran out
+ *         or held bits that are not a code
+ * precondition: tables[k] was built from codes[k] by buildDecodeTable for
+ *               every cluster, stream s holds sizes[s] bytes, dest has room
+ *               for count characters
+ * postcondition: the decoded characters are written to dest
+ *
+*/
+
+template <int numStreams>
+static bool decodeContexts(const canonical_code* const* codes, const decode_entry* const* tables,
+                           const unsigned char* cluster, const unsigned char* const* streams,
+                           const size_t* sizes, size_t count, char* dest) {
+    uint64_t bitBuf[numStreams] = {}; //bits waiting to be decoded in each stream
+    int bitCount[numStreams] = {}; //number of valid bits in each bitBuf
+    size_t pos[numStreams] = {}; //next byte of each stream to load
+    size_t next[numStreams]; //next character of each segment
+    size_t end[numStreams]; //end of each segment
+    unsigned char prev[numStreams] = {}; //character before next in each segment
+
+    for (int s = 0; s < numStreams; s++) {
+        next[s] = count * s / numStreams;
+        end[s] = count * (s + 1) / numStreams;
+    }
+
+    //bulk phase, a refill leaves at least 56 bits, enough for 3 codes
+    for (;;) {
+        bool room = true; //true if every stream has 8 bytes and 3 characters left
+        for (int s = 0; s < numStreams; s++) {
+            room &= sizes[s] - pos[s] >= 8 && end[s] - next[s] >= 3;
+        }
+        if (!room) {
+            break;
+        }
+
+        for (int s = 0; s < numStreams; s++) {
+            uint64_t word; //next 8 bytes of the stream
+            memcpy(&word, streams[s] + pos[s], sizeof(word));
+            bitBuf[s] |= __builtin_bswap64(word) >> bitCount[s];
+            pos[s] += (63 - bitCount[s]) >> 3;
+            bitCount[s] |= 56;
+        }
+
+        for (int k = 0; k < 3; k++) {
+            for (int s = 0; s < numStreams; s++) {
+                int c = cluster[prev[s]]; //cluster of the character before
+                int len = decodeSymbol(*codes[c], tables[c], bitBuf[s], dest[next[s]]);
+                if (len > maxCodeLen) {
+                    return false;
+                }
+                prev[s] = dest[next[s]++];
+                bitBuf[s] <<= len;
+                bitCount[s] -= len;
+            }
+        }
+    }
+
+    //careful phase, each segment is finished on its own
+    for (int s = 0; s < numStreams; s++) {
+        for (; next[s] < end[s]; next[s]++) {
+            while (bitCount[s] <= 56 && pos[s] < sizes[s]) {
+                bitBuf[s] |= (uint64_t)streams[s][pos[s]++] << (56 - bitCount[s]);
+                bitCount[s] += 8;
+            }
+
+            int c = cluster[prev[s]]; //cluster of the character before
+            int len = decodeSymbol(*codes[c], tables[c], bitBuf[s], dest[next[s]]);
+            if (len > maxCodeLen || len > bitCount[s]) {
+                return false;
+            }
+            prev[s] = dest[next[s]];
+            bitBuf[s] <<= len;
+            bitCount[s] -= len;
+        }
+    }
+    return true;
+}
+
+/*
+ * description: decodes exactly count characters of an order-1 block split
+ *              into numStreams segments, as described by decodeContexts
+ * return: true if count characters were decoded, false if the streams ran
+ *         out, held bits that are not a code, or numStreams is not between
+ *         1 and maxStreams
+ * precondition: tables[k] was built from codes[k] by buildDecodeTable for
+ *               every cluster, stream s holds sizes[s] bytes
+ * postcondition: the decoded characters are appended to out, nothing is
+ *                appended if decoding failed
+ *
+*/
+
+bool decodeContextStreams(const canonical_code* const* codes, const decode_entry* const* tables,
+                          const unsigned char cluster[256], const unsigned char* const* streams,
+                          const size_t* sizes, int numStreams, size_t count, string& out) {
+    size_t start = out.size(); //position of the decoded characters in out
+    bool valid = false; //true if every character was decoded
+
+    out.resize(start + count);
+    char* dest = &out[start]; //where the decoded characters go
+
+    switch (numStreams) {
+        case 1: valid = decodeContexts<1>(codes, tables, cluster, streams, sizes, count, dest); break;
+        case 2: valid = decodeContexts<2>(codes, tables, cluster, streams, sizes, count, dest); break;
+        case 3: valid = decodeContexts<3>(codes, tables, cluster, streams, sizes, count, dest); break;
+        case 4: valid = decodeContexts<4>(codes, tables, cluster, streams, sizes, count, dest); break;
+        case 5: valid = decodeContexts<5>(codes, tables, cluster, streams, sizes, count, dest); break;
+        case 6: valid = decodeContexts<6>(codes, tables, cluster, streams, sizes, count, dest); break;
+        case 7: valid = decodeContexts<7>(codes, tables, cluster, streams, sizes, count, dest); break;
+        case 8: valid = decodeContexts<8>(codes, tables, cluster, streams, sizes, count, dest); break;
+    }
+    if (!valid) {
+        out.resize(start);
+    }
+    return valid;
+}
+
+/*
+ * description: finds the number of bytes writeLengths will use for lengths.
+ *              Few characters are stored as a list of characters, many as a
+ *              bitmap of the 256 characters, followed by a 4-bit length per
+ *              used character in both cases.
+ * return: number of bytes in the code length header
+ * precondition: lengths has 256 entries with at least one nonzero length
+ * postcondition: returns the size of the smaller of the two layouts
+ *
+*/
+
+size_t lengthHeaderSize(const unsigned char lengths[256]) {
+    size_t used = 0; //number of used characters
+    for (int i = 0; i < 256; i++) {
+        used += lengths[i] != 0;
+    }
+    return 1 + min(1 + used, (size_t)32) + (used + 1) / 2;
+}
+
+/*
+ * description: appends the code lengths to out in the smaller of the list
+ *              and bitmap layouts described by lengthHeaderSize
+ * return: void (N/A)
+ * precondition: lengths has 256 entries with at least one nonzero length,
+ *               each at most 15
+ * postcondition: lengthHeaderSize(lengths) bytes are appended to out
+ *
+*/
+
+void writeLengths(vector<unsigned char>& out, const unsigned char lengths[256]) {
+    unsigned char used[256]; //used characters in order
+    int numUsed = 0; //number of used characters
+    for (int i = 0; i < 256; i++) {
+        if (lengths[i] != 0) {
+            used[numUsed++] = i;
+        }
+    }
+
+    //list layout: count - 1 then each character
+    if (1 + numUsed < 32) {
+        out.push_back(0);
+        out.push_back(numUsed - 1);
+        out.insert(out.end(), used, used + numUsed);
+    }
+    //bitmap layout: one bit per character
+    else {
+        size_t bitmap = out.size() + 1; //position of the bitmap in out
+        out.push_back(1);
+        out.resize(bitmap + 32, 0);
+        for (int i = 0; i < numUsed; i++) {
+            out[bitmap + used[i] / 8] |= 1 << (used[i] % 8);
+        }
+    }
+
+    //two lengths per byte, first length in the high nibble
+    for (int i = 0; i < numUsed; i += 2) {
+        unsigned char pair = lengths[used[i]] << 4; //two packed lengths
+        if (i + 1 < numUsed) {
+            pair |= lengths[used[i + 1]];
+        }
+        out.push_back(pair);
+    }
+}
+
+/*
+ * description: reads code lengths written by writeLengths
+ * return: true if a valid header was read, false otherwise
+ * precondition: data holds size bytes, pos is the start of the header
+ * postcondition: lengths holds the code length of every character and pos
+ *                is moved past the header
+ *
+*/
+
+bool readLengths(const unsigned char* data, size_t size, size_t& pos,
+                 unsigned char lengths[256]) {
+    unsigned char used[256]; //used characters in order
+    size_t numUsed = 0; //number of used characters
+
+    memset(lengths, 0, 256);
+    if (pos >= size) {
+        return false;
+    }
+
+    //list layout: count - 1 then each character
+    if (data[pos] == 0) {
+        if (size - pos < 2 || size - pos - 2 < (size_t)data[pos + 1] + 1) {
+            return false;
+        }
+        numUsed = data[pos + 1] + 1;
+        memcpy(used, data + pos + 2, numUsed);
+        pos += 2 + numUsed;
+    }
+    //bitmap layout: one bit per character
+    else if (data[pos] == 1) {
+        if (size - pos < 33) {
+            return false;
+        }
+        for (int i = 0; i < 256; i++) {
+            if (data[pos + 1 + i / 8] & (1 << (i % 8))) {
+                used[numUsed++] = i;
+            }
+        }
+        pos += 33;
+    }
+    if (numUsed == 0 || size - pos < (numUsed + 1) / 2) {
+        return false;
+    }
+
+    //two lengths per byte, first length in the high nibble
+    uint64_t total = 0; //sum of 2^(maxCodeLen - length), checks the code
+    for (size_t i = 0; i < numUsed; i++) {
+        unsigned char pair = data[pos + i / 2]; //two packed lengths
+        lengths[used[i]] = (i % 2 == 0) ? pair >> 4 : pair & 15;
+        if (lengths[used[i]] == 0) {
+            return false;
+        }
+        total += 1ull << (maxCodeLen - lengths[used[i]]);
+    }
+    pos += (numUsed + 1) / 2;
+    return total <= (1ull << maxCodeLen);
+}
+
+/*
+ * description: groups the previous characters of an order-1 block into at
+ *              most maxClusters clusters whose followers are alike. The most
+ *              frequent previous characters start the clusters, then every
+ *              previous character is moved to the cluster that would code
+ *              its followers in the fewest bits, a few times over.
+ * return: number of clusters, 1 if there aren't enough previous characters
+ *         to split
+ * precondition: pairFreq holds 256 * 256 counts, 256 * previous + next,
+ *               maxClusters is between 1 and maxContexts
+ * postcondition: cluster holds the cluster of each previous character, 0
+ *                for unused ones, and clusterFreq the followers of each
+ *                cluster
+ *
+*/
+
+int clusterContexts(const uint32_t* pairFreq, int maxClusters, unsigned char cluster[256],
+                    uint64_t clusterFreq[][256]) {
+    uint64_t total[256] = {}; //number of characters after each character
+    int order[256]; //previous characters, most frequent first
+    int numUsed = 0; //number of used previous characters
+    float bits[maxContexts][256]; //estimated bits of each character in each cluster
+    const int rounds = 4; //number of times the characters are moved
+
+    for (int p = 0; p < 256; p++) {
+        for (int c = 0; c < 256; c++) {
+            total[p] += pairFreq[256 * p + c];
+        }
+        if (total[p] != 0) {
+            order[numUsed++] = p;
+        }
+    }
+    sort(order, order + numUsed, [&](int a, int b) { return total[a] > total[b]; });
+    int numClusters = min(maxClusters, numUsed); //number of clusters
+    if (numClusters < 2) {
+        memset(cluster, 0, 256);
+        return 1;
+    }
+
+    //the most frequent previous characters each start a cluster
+    memset(cluster, 0, 256);
+    for (int k = 0; k < maxClusters; k++) {
+        memset(clusterFreq[k], 0, sizeof(clusterFreq[k]));
+    }
+    for (int k = 0; k < numClusters; k++) {
+        for (int c = 0; c < 256; c++) {
+            clusterFreq[k][c] = pairFreq[256 * order[k] + c];
+        }
+    }
+
+    for (int round = 0; round < rounds; round++) {
+        //a character's bits are estimated as -log2 of its smoothed share
+        for (int k = 0; k < numClusters; k++) {
+            uint64_t sum = 0; //number of characters in cluster k
+            for (int c = 0; c < 256; c++) {
+                sum += clusterFreq[k][c];
+            }
+            for (int c = 0; c < 256; c++) {
+                bits[k][c] = log2f((sum + 256.0f) / (clusterFreq[k][c] + 1.0f));
+            }
+        }
+
+        for (int i = 0; i < numUsed; i++) {
+            int p = order[i]; //the previous character being placed
+            float best = 0; //fewest bits of any cluster so far
+            for (int k = 0; k < numClusters; k++) {
+                float cost = 0; //bits of p's followers in cluster k
+                for (int c = 0; c < 256; c++) {
+                    cost += pairFreq[256 * p + c] * bits[k][c];
+                }
+                if (k == 0 || cost < best) {
+                    best = cost;
+                    cluster[p] = k;
+                }
+            }
+        }
+
+        for (int k = 0; k < numClusters; k++) {
+            memset(clusterFreq[k], 0, sizeof(clusterFreq[k]));
+        }
+        for (int i = 0; i < numUsed; i++) {
+            for (int c = 0; c < 256; c++) {
+                clusterFreq[cluster[order[i]]][c] += pairFreq[256 * order[i] + c];
+            }
+        }
+    }
+
+    //drop clusters no character ended up in
+    int renumber[maxContexts]; //new number of each cluster, -1 if empty
+    int numKept = 0; //number of clusters kept
+    for (int k = 0; k < numClusters; k++) {
+        uint64_t sum = 0; //number of characters in cluster k
+        for (int c = 0; c < 256; c++) {
+            sum += clusterFreq[k][c];
+        }
+        renumber[k] = sum != 0 ? numKept : -1;
+        if (sum != 0) {
+            memmove(clusterFreq[numKept++], clusterFreq[k], sizeof(clusterFreq[k]));
+        }
+    }
+    for (int i = 0; i < numUsed; i++) {
+        cluster[order[i]] = renumber[cluster[order[i]]];
+    }
+    return numKept;
+}
+
+/*
+ * description: finds the number of bytes writeContextModel will use
+ * return: number of bytes in the order-1 header
+ * precondition: model holds numClusters sets of lengths
+ * postcondition: none
+ *
+*/
+
+size_t contextHeaderSize(const context_model& model) {
+    size_t size = 2 + 128; //layout, number of clusters and cluster map
+    for (int k = 0; k < model.numClusters; k++) {
+        size += lengthHeaderSize(model.lengths[k]);
+    }
+    return size;
+}
+
+/*
+ * description: appends the code lengths of an order-1 block to out: a 4,
+ *              the number of clusters, the cluster of each previous
+ *              character (two per byte, first in the high nibble) and the
+ *              lengths of each cluster in the layout of writeLengths
+ * return: void (N/A)
+ * precondition: model holds numClusters sets of lengths, each with at least
+ *               one nonzero length
+ * postcondition: contextHeaderSize(model) bytes are appended to out
+ *
+*/
+
+void writeContextModel(vector<unsigned char>& out, const context_model& model) {
+    out.push_back(4);
+    out.push_back(model.numClusters);
+    for (int i = 0; i < 256; i += 2) {
+        out.push_back(model.cluster[i] << 4 | model.cluster[i + 1]);
+    }
+    for (int k = 0; k < model.numClusters; k++) {
+        writeLengths(out, model.lengths[k]);
+    }
+}
+
+/*
+ * description: reads the code lengths of an order-1 block written by
+ *              writeContextModel, starting at its layout byte
+ * return: true if the lengths were valid, false otherwise
+ * precondition: data holds size bytes
+ * postcondition: model holds the clusters and their lengths and pos is
+ *                moved past them
+ *
+*/
+
+bool readContextModel(const unsigned char* data, size_t size, size_t& pos, context_model& model) {
+    if (pos >= size || size - pos < 2 + 128 || data[pos] != 4) {
+        return false;
+    }
+    model.numClusters = data[pos + 1];
+    if (model.numClusters < 2 || model.numClusters > maxContexts) {
+        return false;
+    }
+    for (int i = 0; i < 256; i += 2) {
+        model.cluster[i] = data[pos + 2 + i / 2] >> 4;
+        model.cluster[i + 1] = data[pos + 2 + i / 2] & 15;
+        if (model.cluster[i] >= model.numClusters || model.cluster[i + 1] >= model.numClusters) {
+            return false;
+        }
+    }
+    pos += 2 + 128;
+    for (int k = 0; k < model.numClusters; k++) {
+        if (!readLengths(data, size, pos, model.lengths[k])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * description: adds the number of times each byte appears in data to freq.
+ *              Consecutive bytes go to four separate sub-histograms, so a
+ *              run of the same byte does not make every increment wait on
+ *              the one before it, and eight bytes are loaded at a time.
+ *              Chunks of a larger buffer can be counted on separate threads
+ *              and their histograms added together.
+ * return: void (N/A)
+ * precondition: data holds size bytes, freq has 256 entries
+ * postcondition: freq[b] is increased by the number of bytes equal to b
+ *
+*/
+
+void countBytes(const unsigned char* data, size_t size, uint64_t freq[256]) {
+    uint64_t sub[4][256] = {}; //interleaved sub-histograms
+    size_t i = 0; //next byte to count
+
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word; //eight bytes of data
+        memcpy(&word, data + i, sizeof(word));
+        sub[0][word & 255]++;
+        sub[1][(word >> 8) & 255]++;
+        sub[2][(word >> 16) & 255]++;
+        sub[3][(word >> 24) & 255]++;
+        sub[0][(word >> 32) & 255]++;
+        sub[1][(word >> 40) & 255]++;
+        sub[2][(word >> 48) & 255]++;
+        sub[3][word >> 56]++;
+    }
+    for (; i < size; i++) {
+        sub[0][data[i]]++;
+    }
+
+    for (int b = 0; b < 256; b++) {
+        freq[b] += sub[0][b] + sub[1][b] + sub[2][b] + sub[3][b];
+    }
+}
+
+/*
+ * description: estimates the size of the file -huff -b sourceBlockSize
+ *              writes for data without coding it. The source is looked at a
+ *              segment of whole blocks at a time: a run of sampleRun
+ *              characters is counted every sampleStride characters, the
+ *              average code length of the sample's code is applied to the
+ *              segment, and the headers of its blocks are added. Segments
+ *              are counted at their stored size when coding would not
+ *              shrink them, as the encoder would store their blocks.
+ * return: estimated size of the compressed file in bytes
+ * precondition: data holds size bytes, sourceBlockSize is at least 1
+ * postcondition: none
+ *
+*/
+
+uint64_t estimateSize(const unsigned char* data, uint64_t size, size_t sourceBlockSize) {
+    uint64_t numBlocks = (size + sourceBlockSize - 1) / sourceBlockSize; //blocks in the file
+    uint64_t total = fileHeaderSize; //estimated size, a single block has no trailer
+    if (numBlocks != 1) {
+        total += 12 + numBlocks * indexEntrySize;
+    }
+    //small blocks are grouped so each sample holds enough characters
+    uint64_t blocksPerSegment = max((uint64_t)1, 4 * sampleStride / sourceBlockSize); //blocks
+    //in each segment
+    uint64_t segment = blocksPerSegment * sourceBlockSize; //characters in each segment
+    int streams = min(size, (uint64_t)sourceBlockSize) >= minStreamBlock ? defaultStreams : 1;
+    //streams in each full block
+
+    for (uint64_t start = 0; start < size; start += segment) {
+        uint64_t len = min(segment, size - start); //characters in this segment
+        uint64_t blocks = (len + sourceBlockSize - 1) / sourceBlockSize; //blocks in it
+        uint64_t freq[256] = {}; //frequency of each sampled character
+        unsigned char lengths[256]; //code lengths of the sample's code
+        uint64_t sampled = 0; //number of sampled characters
+        uint64_t bits = 0; //bits of the sampled characters
+
+        //small segments cost little more to count whole than to sample
+        uint64_t stride = len < 4 * sampleStride ? len : sampleStride; //distance between runs
+        uint64_t run = len < 4 * sampleStride ? len : sampleRun; //characters in each run
+        for (uint64_t pos = 0; pos < len; pos += stride) {
+            size_t count = min(run, len - pos); //characters in this run
+            countBytes(data + start + pos, count, freq);
+            sampled += count;
+        }
+        buildCodeLengths(freq, lengths, maxCodeLen);
+        for (int i = 0; i < 256; i++) {
+            bits += freq[i] * lengths[i];
+        }
+
+        uint64_t coded = (uint64_t)((double)bits / sampled * len / 8); //bytes of the
+        //coded characters
+        coded += blocks * (9 + lengthHeaderSize(lengths) + 4 * (streams - 1));
+        total += min(coded, len + blocks * 10);
+    }
+    return total;
+}
+
+/*
+ * description: fills the decode table for the subtree rooted at root. Codes of
+ *              at most lookupBits bits fill every slot that starts with them,
+ *              subtrees deeper than lookupBits are stored so decoding can walk
+ *              the remaining bits one at a time.
+ * return: void (N/A)
+ * precondition: root is the index of a node of the huffman tree, code holds
+ *               the depth bits used to reach it, table has (1 << lookupBits)
+ *               entries
+ * postcondition: no return, but table will hold an entry for every slot
+ *                reachable through root
+ *
+*/
+
+static void buildDecodeTable(const node* tree, int root, unsigned int code, int depth,
+                             decode_entry* table) {
+
+    //if null, nothing to add
+    if (root < 0) {
+        return;
+    }
+
+    //leaf, every slot that starts with this code decodes to it
+    if (tree[root].left < 0) {
+        unsigned int first = code << (lookupBits - depth);
+        unsigned int count = 1u << (lookupBits - depth);
+        for (unsigned int i = 0; i < count; i++) {
+            table[first + i].sub = -1;
+            table[first + i].sym = tree[root].c;
+            table[first + i].len = depth;
+        }
+        return;
+    }
+
+    //code is longer than the table, remember where to continue from
+    if (depth == lookupBits) {
+        table[code].sub = root;
+        table[code].sym = 0;
+        table[code].len = 0;
+        return;
+    }
+
+    //use recursion to traverse the tree and add to the code
+    buildDecodeTable(tree, tree[root].left, code << 1, depth + 1, table);
+    buildDecodeTable(tree, tree[root].right, (code << 1) | 1, depth + 1, table);
+}
+
+/*
+ * description: decodes the bitstream in data using the table-driven decoder,
+ *              appending characters to out until the eof character is
+ *              decoded or the data runs out
+ * return: void (N/A)
+ * precondition: root is the index of the root of the huffman tree, table was
+ *               built from it by buildDecodeTable, data holds size bytes
+ * postcondition: no return, but every decoded character is appended to out
+ *
+*/
+
+static void decodeData(const node* tree, int root, const decode_entry* table,
+                       const unsigned char* data, size_t size, string& out) {
+    uint64_t bitBuf = 0; //bits waiting to be decoded, first bit is the highest
+    int bitCount = 0; //number of valid bits in bitBuf
+    size_t pos = 0; //next byte of data to load into bitBuf
+
+    //a tree with a single leaf has no bits to read
+    if (root < 0 || tree[root].left < 0) {
+        return;
+    }
+
+    while (true) {
+        //refill the bit buffer a byte at a time
+        while (bitCount <= 56 && pos < size) {
+            bitBuf |= (uint64_t)data[pos++] << (56 - bitCount);
+            bitCount += 8;
+        }
+        if (bitCount == 0) {
+            break;
+        }
+
+        const decode_entry& e = table[bitBuf >> (64 - lookupBits)];
+        char ch; //character decoded by this lookup
+
+        //short code, the whole symbol was resolved by the lookup
+        if (e.len != 0) {
+            if (e.len > bitCount) {
+                break;
+            }
+            bitBuf <<= e.len;
+            bitCount -= e.len;
+            ch = e.sym;
+        }
+        //long code, walk the rest of the tree a bit at a time
+        else {
+            if (bitCount < lookupBits) {
+                break;
+            }
+            bitBuf <<= lookupBits;
+            bitCount -= lookupBits;
+
+            int cur = e.sub; //current node of the walk
+            while (tree[cur].left >= 0) {
+                if (bitCount == 0) {
+                    if (pos == size) {
+                        break;
+                    }
+                    bitBuf = (uint64_t)data[pos++] << 56;
+                    bitCount = 8;
+                }
+                cur = (bitBuf >> 63) ? tree[cur].right : tree[cur].left;
+                bitBuf <<= 1;
+                bitCount--;
+            }
+            if (tree[cur].left >= 0) {
+                break;
+            }
+            ch = tree[cur].c;
+        }
+
+        if (ch == eofChar) {
+            break;
+        }
+        out.push_back(ch);
+    }
+}
+
+/*
+ * description: appends the magic number, format version, flags and block
+ *              size that start every file of the canonical encoding
+ * return: void (N/A)
+ * precondition: sourceBlockSize is the number of source bytes in every
+ *               block but the last, singleBlock is true if the file will
+ *               hold exactly one block and no trailer
+ * postcondition: fileHeaderSize bytes are appended to out
+ *
+*/
+
+void writeFileHeader(vector<unsigned char>& out, size_t sourceBlockSize, bool singleBlock) {
+    uint32_t blockSize32 = sourceBlockSize; //block size as stored in the file
+    size_t pos = out.size(); //position of the header in out
+
+    out.resize(pos + fileHeaderSize);
+    memcpy(&out[pos], &canonMagicNum, sizeof(canonMagicNum));
+    out[pos + 4] = formatVersion;
+    out[pos + 5] = singleBlock ? singleBlockFlag : 0;
+    memcpy(&out[pos + 6], &blockSize32, sizeof(blockSize32));
+}
+
+/*
+ * description: reads the header written by writeFileHeader
+ * return: true if data starts with the magic number and format version of
+ *         the canonical encoding, known flags and a nonzero block size,
+ *         false otherwise
+ * precondition: data holds size bytes
+ * postcondition: sourceBlockSize holds the number of source bytes in every
+ *                block but the last
+ *
+*/
+
+bool readFileHeader(const unsigned char* data, uint64_t size, size_t& sourceBlockSize) {
+    int firstNum = 0; //the magic number
+    uint32_t blockSize32 = 0; //block size as stored in the file
+
+    if (size < fileHeaderSize) {
+        return false;
+    }
+    memcpy(&firstNum, data, sizeof(firstNum));
+    memcpy(&blockSize32, data + 6, sizeof(blockSize32));
+    sourceBlockSize = blockSize32;
+    return firstNum == canonMagicNum && data[4] == formatVersion &&
+           (data[5] & ~singleBlockFlag) == 0 && blockSize32 != 0;
+}
+
+/*
+ * description: appends what follows the last block: a zero block length that
+ *              ends the blocks, the seek index, and the number of blocks
+ *              (8 bytes). Each index entry is the block's offset in the file
+ *              (8 bytes) and the number of the block its code lengths were
+ *              written in (8 bytes), so a block can be decoded without the
+ *              ones before. A file of one block is flagged in its header
+ *              and written without a trailer.
+ * return: void (N/A)
+ * precondition: index holds an entry for each block in the file
+ * postcondition: the trailer is appended to out
+ *
+*/
+
+void writeFileTrailer(vector<unsigned char>& out, const vector<block_index>& index) {
+    uint32_t endMark = 0; //block length that ends the blocks
+    uint64_t numBlocks = index.size(); //number of blocks in the file
+    size_t pos = out.size(); //position of the trailer in out
+
+    out.resize(pos + sizeof(endMark) + index.size() * indexEntrySize + sizeof(numBlocks));
+    memcpy(&out[pos], &endMark, sizeof(endMark));
+    pos += sizeof(endMark);
+    for (size_t i = 0; i < index.size(); i++) {
+        memcpy(&out[pos], &index[i].offset, sizeof(index[i].offset));
+        memcpy(&out[pos + 8], &index[i].tableBlock, sizeof(index[i].tableBlock));
+        pos += indexEntrySize;
+    }
+    memcpy(&out[pos], &numBlocks, sizeof(numBlocks));
+}
+
+/*
+ * description: reads the seek index from the end of a file, or makes the
+ *              one entry of a file flagged as a single block
+ * return: true if the file is large enough to hold it, the blocks follow
+ *         one another from the header to the end mark (or to the end of a
+ *         single block file) in the order of their entries, and every
+ *         block's code lengths come from itself or a block before it,
+ *         false otherwise
+ * precondition: data holds the size bytes of the whole file, which starts
+ *               with a header readFileHeader accepts
+ * postcondition: index holds the entry of every block and blocksEnd the
+ *                position of the zero block length after the last block,
+ *                or the end of the file when there is none
+ *
+*/
+
+bool readFileTrailer(const unsigned char* data, uint64_t size,
+                     vector<block_index>& index, uint64_t& blocksEnd) {
+    uint64_t numBlocks = 0; //number of blocks in the file
+    uint32_t blockLen = 0; //length of a block after its length field, or the end mark
+    uint64_t pos = fileHeaderSize; //position the next block has to start at
+
+    if (data[5] & singleBlockFlag) {
+        index.resize(1);
+        index[0].offset = fileHeaderSize;
+        index[0].tableBlock = 0;
+        blocksEnd = size;
+        numBlocks = 1;
+    }
+    else {
+        if (size < fileHeaderSize + 4 + sizeof(numBlocks)) {
+            return false;
+        }
+        memcpy(&numBlocks, &data[size - sizeof(numBlocks)], sizeof(numBlocks));
+        if (numBlocks > (size - fileHeaderSize - 4 - sizeof(numBlocks)) / indexEntrySize) {
+            return false;
+        }
+        uint64_t tableSize = numBlocks * indexEntrySize; //bytes of the index
+
+        uint64_t tableStart = size - sizeof(numBlocks) - tableSize; //position of the index
+        index.resize(numBlocks);
+        for (uint64_t i = 0; i < numBlocks; i++) {
+            const unsigned char* entry = &data[tableStart + i * indexEntrySize]; //entry of
+            //block i
+            memcpy(&index[i].offset, entry, sizeof(index[i].offset));
+            memcpy(&index[i].tableBlock, entry + 8, sizeof(index[i].tableBlock));
+            if (index[i].tableBlock > i) {
+                return false;
+            }
+        }
+        blocksEnd = tableStart - 4;
+        memcpy(&blockLen, &data[blocksEnd], sizeof(blockLen));
+        if (blockLen != 0) {
+            return false;
+        }
+    }
+
+    //each entry has to point at the block right after the one before, so an
+    //index can't repeat a block or skip bytes that aren't one
+    for (uint64_t i = 0; i < numBlocks; i++) {
+        if (index[i].offset != pos || blocksEnd - pos < 4) {
+            return false;
+        }
+        memcpy(&blockLen, &data[pos], sizeof(blockLen));
+        if (blockLen == 0 || blockLen > blocksEnd - pos - 4) {
+            return false;
+        }
+        pos += 4 + blockLen;
+    }
+    return pos == blocksEnd;
+}
+
+/*
+ * description: finds the block that starts at offset
+ * return: true if the block lies between the header and blocksEnd
+ * precondition: data holds the file up to at least blocksEnd
+ * postcondition: block points past the block's length field and len holds
+ *                the length that follows it
+ *
+*/
+
+bool findBlock(const unsigned char* data, uint64_t blocksEnd, uint64_t offset,
+               const unsigned char*& block, size_t& len) {
+    uint32_t blockLen = 0; //length of the block after its length field
+
+    if (offset < fileHeaderSize || offset > blocksEnd || blocksEnd - offset < 4) {
+        return false;
+    }
+    memcpy(&blockLen, &data[offset], sizeof(blockLen));
+    if (blockLen > blocksEnd - offset - 4) {
+        return false;
+    }
+    block = data + offset + 4;
+    len = blockLen;
+    return true;
+}
+
+/*
+ * description: builds the code lengths of a shared table from the character
+ *              counts of a sample corpus. Every character gets a code, even
+ *              ones the corpus never used, so any input can be encoded.
+ * return: void (N/A)
+ * precondition: freq has 256 entries
+ * postcondition: lengths holds the code lengths and id identifies them
+ *
+*/
+
+void shared_table::train(const uint64_t freq[256]) {
+    uint64_t counts[256]; //corpus counts, each raised by one
+
+    for (int i = 0; i < 256; i++) {
+        counts[i] = freq[i] + 1;
+    }
+    buildCodeLengths(counts, lengths, maxCodeLen);
+    id = tableId(lengths);
+}
+
+/*
+ * description: finds the id of a set of code lengths, a 64-bit FNV-1a hash
+ *              of the lengths, which blocks use to refer to a shared table
+ * return: the id, never 0
+ * precondition: lengths has 256 entries
+ * postcondition: none
+ *
+*/
+
+uint64_t tableId(const unsigned char lengths[256]) {
+    uint64_t hash = 14695981039346656037ull; //FNV-1a offset basis
+    for (int i = 0; i < 256; i++) {
+        hash = (hash ^ lengths[i]) * 1099511628211ull;
+    }
+    return hash != 0 ? hash : 1;
+}
+
+/*
+ * description: appends a shared table file: tableMagicNum (4 bytes), the
+ *              table's id (8 bytes) and its code lengths in the layout of
+ *              writeLengths
+ * return: void (N/A)
+ * precondition: table was filled by train or readTable
+ * postcondition: the table file is appended to out
+ *
+*/
+
+void writeTable(vector<unsigned char>& out, const shared_table& table) {
+    size_t pos = out.size(); //position of the table in out
+
+    out.resize(pos + 12);
+    memcpy(&out[pos], &tableMagicNum, sizeof(tableMagicNum));
+    memcpy(&out[pos + 4], &table.id, sizeof(table.id));
+    writeLengths(out, table.lengths);
+}
+
+/*
+ * description: reads a shared table file written by writeTable
+ * return: true if data holds a valid table whose id matches its lengths,
+ *         false otherwise
+ * precondition: data holds size bytes
+ * postcondition: table holds the code lengths and id of the file
+ *
+*/
+
+bool readTable(const unsigned char* data, size_t size, shared_table& table) {
+    int firstNum = 0; //the magic number
+    size_t pos = 12; //position of the code lengths
+
+    if (size < pos) {
+        return false;
+    }
+    memcpy(&firstNum, data, sizeof(firstNum));
+    memcpy(&table.id, data + 4, sizeof(table.id));
+    return firstNum == tableMagicNum && readLengths(data, size, pos, table.lengths) &&
+           tableId(table.lengths) == table.id;
+}
+
+/*
+ * description: finds the shared table a block was written with
+ * return: true if the block uses a shared table, false if it stores or
+ *         reuses its own code lengths
+ * precondition: data holds the size bytes of the block after its length field
+ * postcondition: id holds the id of the shared table if there is one
+ *
+*/
+
+bool blockTableId(const unsigned char* data, size_t size, uint64_t& id) {
+    if (size < 6 + sizeof(id) || data[5] != 3) {
+        return false;
+    }
+    memcpy(&id, data + 6, sizeof(id));
+    return true;
+}
+
+/*
+ * description: reads the header of a block written by writeBlock: its
+ *              number of characters, number of streams and code lengths. A
+ *              block that reuses the code lengths of the block before it
+ *              takes them from prevLengths, one written with a shared table
+ *              takes them from table. An order-1 block fills model and gives
+ *              the lengths of its first cluster, which the block after it
+ *              can reuse.
+ * return: true if the header was valid, false otherwise
+ * precondition: data holds the size bytes of the block after its length
+ *               field, prevLengths is NULL if no block came before, table
+ *               is NULL if there is no shared table
+ * postcondition: lengths, rawLen and numStreams hold the values of the block
+ *                and pos is moved past the code lengths
+ *
+*/
+
+static bool readBlockHeader(const unsigned char* data, size_t size, const unsigned char* prevLengths,
+                            const shared_table* table, unsigned char lengths[256],
+                            context_model& model, uint32_t& rawLen, int& numStreams,
+                            size_t& pos) {
+    uint64_t id; //id of the shared table the block was written with
+
+    if (size < 6) {
+        return false;
+    }
+    memcpy(&rawLen, data, sizeof(rawLen));
+    numStreams = data[4];
+    pos = 5;
+    if (numStreams < 1 || numStreams > maxStreams) {
+        return false;
+    }
+
+    //layout 2: the code lengths of the block before
+    if (data[pos] == 2) {
+        if (prevLengths == NULL) {
+            return false;
+        }
+        memcpy(lengths, prevLengths, 256);
+        pos++;
+        return true;
+    }
+
+    //layout 3: the lengths of the shared table with the id that follows
+    if (blockTableId(data, size, id)) {
+        if (table == NULL || table->id != id) {
+            return false;
+        }
+        memcpy(lengths, table->lengths, 256);
+        pos += 1 + sizeof(id);
+        return true;
+    }
+
+    //layout 5: the raw characters of a block coding would not shrink, which
+    //has no code lengths for the block after it to reuse
+    if (data[pos] == 5) {
+        if (numStreams != 1) {
+            return false;
+        }
+        memset(lengths, 0, 256);
+        pos++;
+        return true;
+    }
+
+    //layout 4: the clusters and lengths of an order-1 block
+    if (data[pos] == 4) {
+        if (!readContextModel(data, size, pos, model)) {
+            return false;
+        }
+        memcpy(lengths, model.lengths[0], 256);
+        return true;
+    }
+    return readLengths(data, size, pos, lengths);
+}
+
+/*
+ * description: finds the code lengths a block is decoded with, following a
+ *              block that reuses the lengths of the block before it back to
+ *              prevLengths. Lets a caller that decodes blocks out of order
+ *              give each one the lengths of the block before it.
+ * return: true if the header was valid, false otherwise
+ * precondition: data holds the size bytes of the block after its length
+ *               field, prevLengths is NULL if no block came before, table
+ *               is NULL if there is no shared table
+ * postcondition: lengths holds the code lengths of the block
+ *
+*/
+
+bool readBlockLengths(const unsigned char* data, size_t size, const unsigned char* prevLengths,
+                      const shared_table* table, unsigned char lengths[256]) {
+    uint32_t rawLen; //number of characters in the block
+    int numStreams; //number of streams in the block
+    size_t pos; //position after the code lengths
+    context_model model; //lengths of an order-1 block
+
+    return readBlockHeader(data, size, prevLengths, table, lengths, model, rawLen, numStreams,
+                           pos);
+}
+
+/*
+ * description: encodes the characters of one interleaved stream, character
+ *              s and every streams-th one after it. The longest code length
+ *              is fixed at compile time, so 56 / maxLen codes go into the
+ *              accumulator between drains without checking for room.
+ * return: void (N/A)
+ * precondition: no code of a character in data is longer than maxLen or
+ *               empty, out is empty
+ * postcondition: out holds the packed stream
+ *
+*/
+
+template <int maxLen>
+static void encodeInterleaved(const canonical_code& code, const char* data, size_t size, int s,
+                              int streams, vector<unsigned char>& out) {
+    const int perDrain = 56 / maxLen; //codes between drains
+    size_t n = size > (size_t)s ? (size - s + streams - 1) / streams : 0; //characters
+    //of the stream
+    const char* src = data + s; //next character of the stream
+    bit_writer writer(out); //packs the stream into bytes
+    size_t i = 0; //number of encoded characters
+
+    for (; n - i >= (size_t)perDrain; i += perDrain) {
+        for (int k = 0; k < perDrain; k++, src += streams) {
+            const code_entry& c = code.codes[(unsigned char)*src];
+            writer.putUnchecked(c.bits, c.len);
+        }
+        writer.drain();
+    }
+    for (; i < n; i++, src += streams) {
+        const code_entry& c = code.codes[(unsigned char)*src];
+        writer.put(c.bits, c.len);
+    }
+    writer.finish();
+}
+
+/*
+ * description: default constructor for the encoder
+ * return: none
+ * precondition: none
+ * postcondition: creates an encoder that collects no stats and splits
+ *                blocks into defaultStreams streams
+ *
+*/
+
+huff_encoder::huff_encoder() {
+    stats = NULL;
+    sharedTable = NULL;
+    numStreams = defaultStreams;
+    contextModel = false;
+    memset(freq, 0, sizeof(freq));
+    memset(lengths, 0, sizeof(lengths));
+    reused = false;
+    contextual = false;
+    stored = false;
+    contextBits = 0;
+}
+
+/*
+ * description: finds the number of streams a block is split into, small
+ *              blocks keep one stream since the stream lengths would cost
+ *              more than decoding them in lockstep saves
+ * return: number of streams, 1 to maxStreams
+ * precondition: none
+ * postcondition: none
+ *
+*/
+
+int huff_encoder::blockStreams(size_t size) const {
+    return size >= minStreamBlock ? max(1, min(numStreams, maxStreams)) : 1;
+}
+
+/*
+ * description: counts the characters of a block and builds its code lengths,
+ *              the first half of encodeBlock. Several encoders can plan
+ *              blocks at the same time before reuseLengths links them. With
+ *              a shared table the block takes the table's lengths, and the
+ *              characters are only counted when stats are collected. With
+ *              contextModel set, an order-1 model is also built and kept if
+ *              it codes the block in fewer bits, header included. A block
+ *              that would not shrink is planned as stored.
+ * return: void (N/A)
+ * precondition: data holds size bytes
+ * postcondition: the block's own code lengths are ready for writeBlock
+ *
+*/
+
+void huff_encoder::planBlock(const char* data, size_t size) {
+    chrono::steady_clock::time_point phase; //start of the current phase
+
+    if (stats != NULL) {
+        phase = chrono::steady_clock::now();
+    }
+    memset(freq, 0, sizeof(freq));
+    reused = false;
+    contextual = false;
+    stored = false;
+
+    //a large block is sampled first, so one that won't shrink skips counting
+    //and building its code. An order-1 model may still shrink it.
+    if (sharedTable == NULL && !contextModel && size >= 4 * sampleStride &&
+        estimateSize((const unsigned char*)data, size, size) >= size) {
+        stored = true;
+        memset(lengths, 0, sizeof(lengths));
+        if (stats != NULL) {
+            countBytes((const unsigned char*)data, size, freq);
+            stats->histogramSeconds += lap(phase);
+        }
+        return;
+    }
+
+    //a large block of a shared table is counted too, to check the table
+    //shrinks it
+    if (sharedTable != NULL) {
+        memcpy(lengths, sharedTable->lengths, sizeof(lengths));
+        if (stats != NULL || size >= 4 * sampleStride) {
+            countBytes((const unsigned char*)data, size, freq);
+            stored = storeRaw(size);
+        }
+        if (stats != NULL) {
+            stats->histogramSeconds += lap(phase);
+        }
+        if (stored) {
+            memset(lengths, 0, sizeof(lengths));
+        }
+        return;
+    }
+
+    //count the characters, an empty block still stores a code
+    countBytes((const unsigned char*)data, size, freq);
+    if (size == 0) {
+        freq[0] = 1;
+    }
+    if (stats != NULL) {
+        stats->histogramSeconds += lap(phase);
+    }
+
+    buildCodeLengths(freq, lengths, maxCodeLen);
+    if (contextModel && size != 0) {
+        contextual = planContexts(data, size);
+    }
+    if (storeRaw(size)) {
+        stored = true;
+        contextual = false;
+        memset(lengths, 0, sizeof(lengths));
+    }
+    if (stats != NULL) {
+        stats->buildSeconds += lap(phase);
+    }
+}
+
+/*
+ * description: checks whether the planned block takes at least as many
+ *              bytes coded as stored as raw characters, comparing what
+ *              follows the number of streams in each layout
+ * return: true if the block should be stored, false otherwise
+ * precondition: planBlock counted the block and built its code lengths
+ * postcondition: none
+ *
+*/
+
+bool huff_encoder::storeRaw(size_t size) const {
+    uint64_t bits = 0; //bits of the coded block after the number of streams
+
+    if (contextual) {
+        bits = contextBits + 8 * contextHeaderSize(model);
+    }
+    else {
+        bits = 8 * (sharedTable != NULL ? 1 + sizeof(sharedTable->id) : lengthHeaderSize(lengths));
+        for (int i = 0; i < 256; i++) {
+            bits += freq[i] * lengths[i];
+        }
+    }
+    return (bits + 7) / 8 + 4 * (blockStreams(size) - 1) >= size + 1;
+}
+
+/*
+ * description: builds an order-1 model of the planned block: counts each
+ *              character after the one before it (0 at the start of each
+ *              stream's segment), clusters the previous characters and
+ *              builds the code lengths of each cluster
+ * return: true if the model codes the block in fewer bits than its order-0
+ *         lengths, counting both headers, false otherwise
+ * precondition: planBlock counted the block and built its order-0 lengths
+ * postcondition: if true is returned, model and contextBits describe the
+ *                block and lengths holds the lengths of its first cluster
+ *
+*/
+
+bool huff_encoder::planContexts(const char* data, size_t size) {
+    const unsigned char* bytes = (const unsigned char*)data; //the block
+    int streams = blockStreams(size); //number of segments in the block
+    uint64_t clusterFreq[maxContexts][256]; //characters in each cluster
+    uint64_t ownBits = 8 * lengthHeaderSize(lengths); //bits with the order-0 lengths
+
+    pairFreq.assign(256 * 256, 0);
+    for (int s = 0; s < streams; s++) {
+        unsigned char prev = 0; //character before i in the segment
+        for (size_t i = size * s / streams; i < size * (s + 1) / streams; i++) {
+            pairFreq[256 * prev + bytes[i]]++;
+            prev = bytes[i];
+        }
+    }
+    model.numClusters = clusterContexts(pairFreq.data(), maxContexts, model.cluster, clusterFreq);
+    if (model.numClusters < 2) {
+        return false;
+    }
+
+    contextBits = 0;
+    for (int k = 0; k < model.numClusters; k++) {
+        buildCodeLengths(clusterFreq[k], model.lengths[k], maxCodeLen);
+        for (int c = 0; c < 256; c++) {
+            contextBits += clusterFreq[k][c] * model.lengths[k][c];
+        }
+    }
+    for (int i = 0; i < 256; i++) {
+        ownBits += freq[i] * lengths[i];
+    }
+    if (contextBits + 8 * contextHeaderSize(model) >= ownBits) {
+        return false;
+    }
+    memcpy(lengths, model.lengths[0], sizeof(lengths));
+    return true;
+}
+
+/*
+ * description: switches the planned block to the code lengths of the block
+ *              written before it when that costs fewer bits in total: the
+ *              encoding gets a little longer, but the block's code length
+ *              header shrinks to a single byte
+ * return: true if the previous lengths will be used, false otherwise
+ * precondition: planBlock was called for this block, prevLengths are the
+ *               lengths the previous block was written with
+ * postcondition: codeLengths holds the lengths writeBlock will use
+ *
+*/
+
+bool huff_encoder::reuseLengths(const unsigned char prevLengths[256]) {
+    //an order-1 block only planned its model because it beat its own
+    //order-0 lengths, a stored block may not have counted its characters
+    if (contextual || stored) {
+        return false;
+    }
+
+    //a block of a shared table wasn't counted, but its table reference is
+    //only worth replacing by the same lengths
+    if (sharedTable != NULL) {
+        reused = memcmp(lengths, prevLengths, sizeof(lengths)) == 0;
+        return reused;
+    }
+
+    uint64_t ownBits = 8 * lengthHeaderSize(lengths); //bits of the block with its own lengths
+    uint64_t prevBits = 8; //bits of the block with the previous lengths
+
+    for (int i = 0; i < 256; i++) {
+        if (freq[i] != 0 && prevLengths[i] == 0) {
+            return false;
+        }
+        ownBits += freq[i] * lengths[i];
+        prevBits += freq[i] * prevLengths[i];
+    }
+    if (prevBits > ownBits) {
+        return false;
+    }
+    memcpy(lengths, prevLengths, sizeof(lengths));
+    reused = true;
+    return true;
+}
+
+/*
+ * description: gives the code lengths writeBlock will use for the planned
+ *              block
+ * return: the 256 code lengths
+ * precondition: planBlock was called
+ * postcondition: none
+ *
+*/
+
+const unsigned char* huff_encoder::codeLengths() const {
+    return lengths;
+}
+
+/*
+ * description: compresses the planned block, the second half of
+ *              encodeBlock. The block is stored as its compressed length (4
+ *              bytes, not counting itself), its number of characters (4
+ *              bytes), its number of streams (1 byte), the code lengths of
+ *              its canonical code (or a single 2 if it reuses the lengths of
+ *              the block before, a 3 and the table's id if it uses a
+ *              shared table, or the model of writeContextModel for an
+ *              order-1 block), the length of every stream but the last (4
+ *              bytes each), and the streams. A block coding would not
+ *              shrink is stored instead as one stream, a single 5 and its
+ *              characters. Character i is encoded in
+ *              stream i % streams, so the decoder can work on every stream
+ *              at once, except in an order-1 block where each stream holds
+ *              one of streams consecutive segments. Every byte value can be
+ *              encoded since the decoder stops after the stored count.
+ * return: void (N/A)
+ * precondition: planBlock was called with the same data and size, size is
+ *               at most maxBlockSize
+ * postcondition: no return, but the compressed block is appended to out
+ *
+*/
+
+void huff_encoder::writeBlock(const char* data, size_t size, vector<unsigned char>& out) {
+    size_t start = out.size(); //position of the block in out
+    chrono::steady_clock::time_point phase; //start of the current phase
+
+    if (stats != NULL) {
+        phase = chrono::steady_clock::now();
+    }
+
+    //a stored block is its header and the characters as they are
+    if (stored) {
+        uint32_t blockLen = 6 + size; //length of the block after this field
+        uint32_t rawLen = size; //number of characters in the block
+        out.resize(start + 10);
+        memcpy(&out[start], &blockLen, sizeof(blockLen));
+        memcpy(&out[start + 4], &rawLen, sizeof(rawLen));
+        out[start + 8] = 1;
+        out[start + 9] = 5;
+        out.insert(out.end(), data, data + size);
+        if (stats != NULL) {
+            stats->encodeSeconds += lap(phase);
+            stats->blocks++;
+            stats->storedBlocks++;
+            stats->codedBits += 8 * (uint64_t)size;
+            for (int i = 0; i < 256; i++) {
+                stats->freq[i] += size == 0 ? 0 : freq[i];
+            }
+        }
+        return;
+    }
+
+    code.assign(lengths);
+    const canonical_code* codes[maxContexts] = {&code}; //code of each cluster
+    if (contextual) {
+        contextCodes.resize(maxContexts);
+        for (int k = 1; k < model.numClusters; k++) {
+            contextCodes[k].assign(model.lengths[k]);
+            codes[k] = &contextCodes[k];
+        }
+    }
+    int streams = blockStreams(size); //number of streams in this block
+    int longest = *max_element(lengths, lengths + 256); //longest code length
+
+    //block length is filled in once the block is complete
+    uint32_t rawLen = size; //number of characters in the block
+    out.resize(start + 9);
+    memcpy(&out[start + 4], &rawLen, sizeof(rawLen));
+    out[start + 8] = streams;
+    if (reused) {
+        out.push_back(2);
+    }
+    else if (contextual) {
+        writeContextModel(out, model);
+    }
+    else if (sharedTable != NULL) {
+        out.push_back(3);
+        out.resize(out.size() + sizeof(sharedTable->id));
+        memcpy(&out[out.size() - sizeof(sharedTable->id)], &sharedTable->id,
+               sizeof(sharedTable->id));
+    }
+    else {
+        writeLengths(out, lengths);
+    }
+    if (stats != NULL) {
+        stats->headerSeconds += lap(phase);
+    }
+
+    //each stream is packed into its own buffer, then appended after the
+    //stream lengths
+    for (int s = 0; s < streams; s++) {
+        streamBufs[s].clear();
+        if (contextual) {
+            bit_writer writer(streamBufs[s]); //packs stream s into bytes
+            unsigned char prev = 0; //character before i in the segment
+            for (size_t i = size * s / streams; i < size * (s + 1) / streams; i++) {
+                const code_entry& c = codes[model.cluster[prev]]->codes[(unsigned char)data[i]];
+                writer.put(c.bits, c.len);
+                prev = data[i];
+            }
+            writer.finish();
+        }
+        //the kernel is picked by the longest code, short codes drain less often
+        else if (longest <= 4) {
+            encodeInterleaved<4>(code, data, size, s, streams, streamBufs[s]);
+        }
+        else if (longest <= 8) {
+            encodeInterleaved<8>(code, data, size, s, streams, streamBufs[s]);
+        }
+        else {
+            encodeInterleaved<maxCodeLen>(code, data, size, s, streams, streamBufs[s]);
+        }
+    }
+    for (int s = 0; s + 1 < streams; s++) {
+        uint32_t streamLen = streamBufs[s].size(); //length of stream s
+        size_t pos = out.size(); //position of the length in out
+        out.resize(pos + sizeof(streamLen));
+        memcpy(&out[pos], &streamLen, sizeof(streamLen));
+    }
+    for (int s = 0; s < streams; s++) {
+        out.insert(out.end(), streamBufs[s].begin(), streamBufs[s].end());
+    }
+
+    uint32_t blockLen = out.size() - start - 4; //length of the block after this field
+    memcpy(&out[start], &blockLen, sizeof(blockLen));
+
+    if (stats != NULL) {
+        stats->encodeSeconds += lap(phase);
+        stats->blocks++;
+        stats->reusedTables += reused;
+        stats->codedBits += contextual ? contextBits : 0;
+        for (int i = 0; i < 256; i++) {
+            uint64_t count = size == 0 ? 0 : freq[i]; //times the character was encoded
+            stats->codedBits += contextual ? 0 : count * lengths[i];
+            stats->freq[i] += count;
+            for (int k = 0; k < (contextual ? model.numClusters : 1); k++) {
+                const unsigned char* used = contextual ? model.lengths[k] : lengths; //lengths
+                //of cluster k
+                stats->maxCodeLen = max(stats->maxCodeLen, (int)used[i]);
+            }
+        }
+    }
+}
+
+/*
+ * description: compresses one block of the source on its own, with its own
+ *              code lengths, in the layout described by writeBlock
+ * return: void (N/A)
+ * precondition: data holds size bytes
+ * postcondition: no return, but the compressed block is appended to out
+ *
+*/
+
+void huff_encoder::encodeBlock(const char* data, size_t size, vector<unsigned char>& out) {
+    planBlock(data, size);
+    writeBlock(data, size, out);
+}
+
+/*
+ * description: compresses a whole buffer into the canonical file format,
+ *              the same bytes -huff -b sourceBlockSize writes for a file
+ *              holding the buffer. Blocks are at most maxBlockSize bytes.
+ * return: void (N/A)
+ * precondition: data holds size bytes, sourceBlockSize is at least 1
+ * postcondition: out holds the compressed buffer, its previous contents are
+ *                replaced but its capacity is kept
+ *
+*/
+
+void huff_encoder::compress(const char* data, size_t size, vector<unsigned char>& out,
+                            size_t sourceBlockSize) {
+    //a block's lengths are stored in 32 bits
+    sourceBlockSize = min(sourceBlockSize, maxBlockSize);
+    out.clear();
+    index.clear();
+    bool singleBlock = size != 0 && size <= sourceBlockSize; //true if the file has no trailer
+    writeFileHeader(out, sourceBlockSize, singleBlock);
+    for (size_t pos = 0; pos < size; pos += sourceBlockSize) {
+        size_t len = min(sourceBlockSize, size - pos); //length of this block
+        unsigned char prevLengths[256]; //lengths of the block before
+        memcpy(prevLengths, lengths, sizeof(prevLengths));
+
+        block_index entry; //index entry of this block
+        entry.offset = out.size();
+        entry.tableBlock = index.size();
+        planBlock(data + pos, len);
+        if (pos != 0 && reuseLengths(prevLengths)) {
+            entry.tableBlock = index.back().tableBlock;
+        }
+        writeBlock(data + pos, len, out);
+        index.push_back(entry);
+    }
+    if (!singleBlock) {
+        writeFileTrailer(out, index);
+    }
+}
+
+/*
+ * description: default constructor for the decoder
+ * return: none
+ * precondition: none
+ * postcondition: creates a decoder that collects no stats
+ *
+*/
+
+huff_decoder::huff_decoder() {
+    stats = NULL;
+    sharedTable = NULL;
+    haveCode = false;
+    chained = false;
+    multiBits = 0;
+    haveMulti = false;
+}
+
+/*
+ * description: decompresses one block written by writeBlock. A block that
+ *              reuses the code lengths of the block before it takes them
+ *              from prevLengths, or from the block this decoder decoded last
+ *              in the same buffer if prevLengths is NULL. The decode table is
+ *              only rebuilt when the lengths change, even between buffers.
+ * return: true if the block was valid, false otherwise
+ * precondition: data holds the size bytes of the block after its length field
+ * postcondition: the decoded characters of the block are appended to out
+ *
+*/
+
+bool huff_decoder::decodeBlock(const unsigned char* data, size_t size, string& out,
+                               const unsigned char* prevLengths) {
+    unsigned char lengths[256]; //code length of each character
+    uint32_t rawLen; //number of characters in the block
+    int numStreams; //number of streams in the block
+    const unsigned char* streams[maxStreams]; //start of each stream
+    size_t sizes[maxStreams]; //length of each stream
+    size_t pos; //position in data after the code lengths
+    size_t start = out.size(); //position of the block in out
+    chrono::steady_clock::time_point phase; //start of the current phase
+
+    if (stats != NULL) {
+        phase = chrono::steady_clock::now();
+    }
+
+    if (prevLengths == NULL && haveCode && chained) {
+        prevLengths = code.lengths;
+    }
+    if (!readBlockHeader(data, size, prevLengths, sharedTable, lengths, model, rawLen, numStreams,
+                         pos) ||
+        size - pos < 4 * (size_t)(numStreams - 1)) {
+        return false;
+    }
+
+    //a stored block holds exactly its characters
+    if (data[5] == 5) {
+        if (size - pos != rawLen) {
+            return false;
+        }
+        out.append((const char*)data + pos, rawLen);
+        chained = false;
+        if (stats != NULL) {
+            uint64_t freq[256] = {}; //frequency of each copied character
+            stats->encodeSeconds += lap(phase);
+            countBytes(data + pos, rawLen, freq);
+            stats->blocks++;
+            stats->storedBlocks++;
+            stats->codedBits += 8 * (uint64_t)rawLen;
+            for (int i = 0; i < 256; i++) {
+                stats->freq[i] += freq[i];
+            }
+            stats->histogramSeconds += lap(phase);
+        }
+        return true;
+    }
+
+    //every stream but the last has its length stored, the last one takes
+    //the rest of the block
+    size_t streamPos = pos + 4 * (numStreams - 1); //start of the next stream
+    for (int s = 0; s < numStreams; s++) {
+        uint32_t streamLen = size - streamPos; //length of stream s
+        if (s + 1 < numStreams) {
+            memcpy(&streamLen, data + pos + 4 * s, sizeof(streamLen));
+        }
+        if (streamLen > size - streamPos) {
+            return false;
+        }
+        streams[s] = data + streamPos;
+        sizes[s] = streamLen;
+        streamPos += streamLen;
+    }
+    if (rawLen / 8 > size - pos) {
+        return false;
+    }
+    if (stats != NULL) {
+        stats->headerSeconds += lap(phase);
+    }
+
+    if (!haveCode || memcmp(lengths, code.lengths, sizeof(lengths)) != 0) {
+        code.assign(lengths);
+        buildDecodeTable(code, table);
+        multiBits = multiTableBits(code);
+        haveMulti = false;
+        haveCode = true;
+    }
+
+    //the multi-symbol table is only built once a block is long enough to
+    //pay for filling it
+    bool useMulti = multiBits != 0 && rawLen >= (4u << multiBits); //true to decode
+    //several characters per lookup
+    if (useMulti && !haveMulti) {
+        multiTable.resize(1 << maxMultiBits);
+        buildMultiTable(code, multiBits, multiTable.data());
+        haveMulti = true;
+    }
+
+    //an order-1 block keeps its first cluster in code and table
+    bool contextual = data[5] == 4; //true for an order-1 block
+    const canonical_code* codes[maxContexts] = {&code}; //code of each cluster
+    const decode_entry* tables[maxContexts] = {table}; //decode table of each cluster
+    if (contextual) {
+        contextCodes.resize(maxContexts);
+        contextTables.resize(maxContexts << lookupBits);
+        for (int k = 1; k < model.numClusters; k++) {
+            contextCodes[k].assign(model.lengths[k]);
+            buildDecodeTable(contextCodes[k], &contextTables[k << lookupBits]);
+            codes[k] = &contextCodes[k];
+            tables[k] = &contextTables[k << lookupBits];
+        }
+    }
+    if (stats != NULL) {
+        stats->buildSeconds += lap(phase);
+    }
+
+    //small alphabets decode several characters per lookup
+    bool valid; //true if the block decoded
+    if (contextual) {
+        valid = decodeContextStreams(codes, tables, model.cluster, streams, sizes, numStreams,
+                                     rawLen, out);
+    }
+    else if (useMulti) {
+        valid = decodeMultiStreams(code, table, multiTable.data(), multiBits, streams, sizes,
+                                   numStreams, rawLen, out);
+    }
+    else {
+        valid = decodeStreams(code, table, streams, sizes, numStreams, rawLen, out);
+    }
+    if (!valid) {
+        return false;
+    }
+    chained = true;
+
+    if (stats != NULL) {
+        stats->encodeSeconds += lap(phase);
+
+        //count the decoded characters so the entropy can be reported
+        uint64_t freq[256] = {}; //frequency of each decoded character
+        countBytes((const unsigned char*)out.data() + start, out.size() - start, freq);
+        stats->blocks++;
+        stats->reusedTables += data[5] == 2;
+        for (int s = 0; s < numStreams && contextual; s++) {
+            stats->codedBits += 8 * sizes[s];
+        }
+        for (int i = 0; i < 256; i++) {
+            stats->codedBits += contextual ? 0 : freq[i] * lengths[i];
+            stats->freq[i] += freq[i];
+            for (int k = 0; k < (contextual ? model.numClusters : 1); k++) {
+                const unsigned char* used = contextual ? model.lengths[k] : lengths; //lengths
+                //of cluster k
+                stats->maxCodeLen = max(stats->maxCodeLen, (int)used[i]);
+            }
+        }
+        stats->histogramSeconds += lap(phase);
+    }
+    return true;
+}
+
+/*
+ * description: decompresses a whole buffer in either the canonical file
+ *              format or the original format. The character counts in
+ *              the canonical block headers are added up first, so a buffer
+ *              that would decode to more than maxSize bytes is refused
+ *              before any of it is decoded.
+ * return: true if the buffer was valid and decoded to at most maxSize
+ *         bytes, false otherwise
+ * precondition: data holds size bytes
+ * postcondition: out holds the decompressed buffer, its previous contents
+ *                are replaced but its capacity is kept
+ *
+*/
+
+bool huff_decoder::decompress(const unsigned char* data, size_t size, string& out,
+                              uint64_t maxSize) {
+    int firstNum = 0; //the magic number
+    size_t sourceBlockSize; //number of source bytes in each block
+    uint64_t blocksEnd; //position of the zero block length after the last block
+    uint64_t total = 0; //number of characters the blocks hold
+
+    out.clear();
+    if (size < sizeof(firstNum)) {
+        return false;
+    }
+    memcpy(&firstNum, data, sizeof(firstNum));
+    if (firstNum == legacyMagicNum) {
+        return decodeLegacy(data, size, out) && out.size() <= maxSize;
+    }
+    if (!readFileHeader(data, size, sourceBlockSize) ||
+        !readFileTrailer(data, size, index, blocksEnd)) {
+        return false;
+    }
+    for (size_t i = 0; i < index.size(); i++) {
+        const unsigned char* block; //the block after its length field
+        size_t len; //length of the block after its length field
+        uint32_t rawLen = 0; //number of characters in the block
+        if (!findBlock(data, blocksEnd, index[i].offset, block, len) || len < sizeof(rawLen)) {
+            return false;
+        }
+        memcpy(&rawLen, block, sizeof(rawLen));
+        total += rawLen;
+    }
+    if (total > maxSize) {
+        return false;
+    }
+
+    chained = false;
+    for (size_t i = 0; i < index.size(); i++) {
+        const unsigned char* block; //the block after its length field
+        size_t len; //length of the block after its length field
+        if (!findBlock(data, blocksEnd, index[i].offset, block, len) ||
+            !decodeBlock(block, len, out)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * description: decompresses length bytes of the source starting at offset,
+ *              using the seek index so only the blocks holding the range are
+ *              decoded, along with the header of the block each of them
+ *              takes its code lengths from. A range past the end of the
+ *              source is cut short.
+ * return: true if the file and the blocks of the range were valid, false
+ *         otherwise
+ * precondition: data holds the size bytes of a whole file of the canonical
+ *               encoding
+ * postcondition: out holds the bytes of the range, its previous contents
+ *                are replaced but its capacity is kept
+ *
+*/
+
+bool huff_decoder::extract(const unsigned char* data, size_t size, uint64_t offset,
+                           uint64_t length, string& out) {
+    size_t sourceBlockSize; //number of source bytes in each block
+    uint64_t blocksEnd; //position of the zero block length after the last block
+
+    out.clear();
+    if (!readFileHeader(data, size, sourceBlockSize) ||
+        !readFileTrailer(data, size, index, blocksEnd)) {
+        return false;
+    }
+    if (length == 0 || offset / sourceBlockSize >= index.size()) {
+        return true;
+    }
+
+    uint64_t end = offset + min(length, UINT64_MAX - offset); //end of the range
+    size_t last = min((end - 1) / sourceBlockSize, (uint64_t)index.size() - 1); //last block
+    //of the range
+    for (size_t i = offset / sourceBlockSize; i <= last; i++) {
+        const unsigned char* block; //the block after its length field
+        size_t len; //length of the block after its length field
+        unsigned char lengths[256]; //code lengths of the block holding this block's lengths
+        const unsigned char* prevLengths = NULL; //lengths this block may reuse
+
+        //a block that reuses code lengths takes them from the block they
+        //were written in
+        if (index[i].tableBlock != i) {
+            if (!findBlock(data, blocksEnd, index[index[i].tableBlock].offset, block, len) ||
+                !readBlockLengths(block, len, NULL, sharedTable, lengths)) {
+                return false;
+            }
+            prevLengths = lengths;
+        }
+
+        size_t blockStart = out.size(); //position of the block in out
+        chained = false;
+        uint64_t blockOffset = (uint64_t)i * sourceBlockSize; //source offset of the block
+        if (!findBlock(data, blocksEnd, index[i].offset, block, len) ||
+            !decodeBlock(block, len, out, prevLengths) ||
+            (i + 1 < index.size() && out.size() - blockStart != sourceBlockSize)) {
+            return false;
+        }
+
+        //keep only the part of the block inside the range
+        uint64_t keepEnd = min(end - blockOffset, (uint64_t)(out.size() - blockStart)); //end of
+        //the range within the block
+        uint64_t keepStart = offset > blockOffset ? offset - blockOffset : 0; //start of the
+        //range within the block
+        if (keepStart > keepEnd) {
+            keepStart = keepEnd;
+        }
+        out.resize(blockStart + keepEnd);
+        out.erase(blockStart, keepStart);
+    }
+    return true;
+}
+
+/*
+ * description: decompresses a whole file of the original encoding, which
+ *              stored the frequency of every character. The Huffman tree is
+ *              rebuilt in a flat array with the same priority queue order
+ *              the original encoder used, so the codes match.
+ * return: true if the header was complete, false otherwise
+ * precondition: data holds the size bytes of the file, starting with the
+ *               magic number
+ * postcondition: the decoded characters are appended to out
+ *
+*/
+
+bool huff_decoder::decodeLegacy(const unsigned char* data, size_t size, string& out) {
+    int numLets = 0; //variable to read number of characters
+    int heap[maxTreeNodes]; //priority queue of tree indices used to create
+    //the huffman tree
+    int heapSize = 0; //number of indices in heap
+    int numNodes = 0; //number of nodes in tree
+    size_t pos = 8; //position in data after the magic number and numLets
+    cmp_node cmp(tree); //orders heap with the lowest count on top
+
+    //the table is about to hold the tree instead of a canonical code
+    haveCode = false;
+    if (size < pos) {
+        return false;
+    }
+    memcpy(&numLets, data + 4, sizeof(numLets));
+    if (numLets < 1 || numLets > 256 || size - pos < (size_t)numLets * 5) {
+        return false;
+    }
+
+    //read in each character and its frequency, add them to the queue
+    for (int i = 0; i < numLets; i++) {
+        node& leaf = tree[numNodes]; //the new leaf
+        uint32_t count; //frequency as the original encoding stored it
+        leaf.c = data[pos];
+        memcpy(&count, data + pos + 1, sizeof(count));
+        leaf.count = count;
+        leaf.left = -1;
+        leaf.right = -1;
+        pos += 5;
+
+        heap[heapSize++] = numNodes++;
+        push_heap(heap, heap + heapSize, cmp);
+    }
+
+    //create huffman tree by combining nodes with smallest values
+    while (heapSize > 1) {
+        pop_heap(heap, heap + heapSize, cmp);
+        int n3 = heap[--heapSize]; //node with the smallest count
+        pop_heap(heap, heap + heapSize, cmp);
+        int n4 = heap[--heapSize]; //node with the next smallest count
+
+        node& parent = tree[numNodes]; //the new internal node
+        parent.c = '\0';
+        parent.count = tree[n3].count + tree[n4].count;
+        parent.left = n3;
+        parent.right = n4;
+
+        heap[heapSize++] = numNodes++;
+        push_heap(heap, heap + heapSize, cmp);
+    }
+
+    //create the decode table from the huffman tree and decode the rest
+    buildDecodeTable(tree, heap[0], 0, 0, table);
+    decodeData(tree, heap[0], table, data + pos, size - pos, out);
+    return true;
+}
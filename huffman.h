@@ -0,0 +1,406 @@
+/*
+ * File: huffman.h
+ * Description: Huffman encoding library used by huffmanEncoding.cpp. It holds the
+ *     canonical code construction, the bit writer, the table-driven decoder and
+ *     the block format, so a program can compress and decompress buffers in
+ *     memory without going through files. Encoder and decoder objects keep
+ *     their tables and buffers between calls, so one object can be reused for
+ *     any number of buffers.
+ */
+
+#ifndef HUFFMAN_H
+#define HUFFMAN_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+const size_t blockSize = 1 << 20; //number of source bytes in each block
+//unless set otherwise, also the distance between seek index entries
+const size_t minBlockSize = 1 << 10; //smallest block size -huff accepts
+const size_t maxBlockSize = 1 << 30; //largest block size -huff accepts
+const int legacyMagicNum = 312341; //arbitrary random number used as the
+//magic number for our original huffman encoding, which stored frequencies
+const int canonMagicNum = 312342; //magic number for the canonical huffman encoding
+const int tableMagicNum = 312343; //magic number of a shared code table file
+const unsigned char formatVersion = 11; //version of the canonical encoding
+const size_t fileHeaderSize = 10; //magic number(4), version(1), flags(1) and block size(4)
+const unsigned char singleBlockFlag = 1; //header flag of a file that holds one block
+//and nothing after it, no end mark or seek index
+const size_t indexEntrySize = 16; //offset(8) and table block(8) of a seek index entry
+const char eofChar = 13; //eof character the original encoding used to
+//signify when we are done reading, canonical blocks store their length instead
+const int lookupBits = 11; //number of bits resolved by one decode table lookup
+const int maxCodeLen = 15; //longest canonical code, so a length fits in 4 bits
+const int maxWeightBits = 54; //frequencies are scaled below 2^maxWeightBits when
+//building a code, so the weights of 256 characters add up without overflowing
+const int maxTreeNodes = 511; //number of nodes in a tree of 256 characters
+const int maxStreams = 8; //most interleaved bitstreams in a block
+const int defaultStreams = 4; //interleaved bitstreams in a block unless set otherwise
+const size_t minStreamBlock = 1 << 14; //smaller blocks are kept in one bitstream
+const int maxContexts = 8; //most sets of code lengths in an order-1 block
+const int maxMultiSyms = 6; //most characters one multi-symbol lookup decodes
+const int maxMultiBits = 12; //longest code a multi-symbol table can hold
+const int smallAlphabet = 32; //most characters a code has to use a
+//multi-symbol table
+const size_t sampleRun = 4 << 10; //bytes in each run a size estimate counts
+const size_t sampleStride = 64 << 10; //distance between the starts of sampled runs,
+//smaller sources are counted whole
+
+//node of the Huffman tree of the original encoding, kept in a flat array
+struct node {
+    uint64_t count; //variable for the char frequency
+    char c; //the char of the node, any value for a leaf, '\0' for an internal node
+    int left, right; //index of the left and right children of the node, -1 for a leaf
+};
+
+//class used to compare two nodes of a flat tree by their index
+class cmp_node {
+public:
+    const node* nodes; //the tree the indices refer to
+
+    /*
+     * description: constructor for the comparison
+     * return: none
+     * precondition: tree is the array the compared indices refer to
+     * postcondition: creates a comparison of nodes in tree
+     *
+    */
+    cmp_node(const node* tree) {
+        nodes = tree;
+    }
+
+    /*
+     * description: this function compares two nodes, returns true
+     *              if first node has higher frequency than the second
+     * return: true if node a has the higher count, false otherwise
+     * precondition: a and b are valid indices in nodes
+     * postcondition: returns true if a has a higher count data member,
+     *                false otherwise
+     *
+    */
+    bool operator()(int a, int b) const {
+        return nodes[a].count > nodes[b].count;
+    }
+};
+
+//entry of the decode table, indexed by the next lookupBits bits of the encoding
+struct decode_entry {
+    int sub; //subtree to continue from when the code is longer than lookupBits,
+    //-1 for canonical codes, which search the longer lengths instead
+    char sym; //the char decoded by this entry
+    int len; //length of the code in bits, 0 if decoding continues past the table
+};
+
+//entry of a multi-symbol decode table, which decodes every whole code in
+//the index bits with one lookup when all codes fit in the table
+struct multi_entry {
+    unsigned char syms[maxMultiSyms]; //the decoded chars, in order
+    unsigned char count; //number of decoded chars, 0 if the bits are not a code
+    unsigned char bits; //number of bits the decoded chars use
+};
+
+//code of a single character, stored as an integer instead of a string
+struct code_entry {
+    uint64_t bits; //the code, right aligned
+    int len; //number of bits in the code
+};
+
+//canonical huffman code, rebuilt by the decoder from the code lengths alone
+struct canonical_code {
+    unsigned char lengths[256]; //code length of each character, 0 if unused
+    code_entry codes[256]; //code of each character
+    int count[maxCodeLen + 1]; //number of codes of each length
+    int firstCode[maxCodeLen + 1]; //numerically first code of each length
+    int firstIndex[maxCodeLen + 1]; //index in sorted of the first code of each length
+    unsigned char sorted[256]; //used characters ordered by (length, character)
+    int numSyms; //number of used characters
+
+    void assign(const unsigned char newLengths[256]);
+};
+
+//class used to pack codes into bytes through a 64-bit accumulator,
+//appending them to a vector owned by the caller
+class bit_writer {
+public:
+    std::vector<unsigned char>* buf; //packed bytes, only the first size are valid
+    //until finish is called
+    size_t size; //number of complete bytes in buf
+    uint64_t acc; //pending bits, the first bit is the highest
+    int count; //number of pending bits in acc
+
+    /*
+     * description: constructor for the bit writer
+     * return: none
+     * precondition: out stays alive while the writer is used
+     * postcondition: creates a writer that appends to out
+     *
+    */
+    bit_writer(std::vector<unsigned char>& out) {
+        buf = &out;
+        size = out.size();
+        acc = 0;
+        count = 0;
+    }
+
+    /*
+     * description: appends a code to the bitstream
+     * return: void (N/A)
+     * precondition: len is at most 56 and bits has no set bits above len
+     * postcondition: the code is added after all previously written codes
+     *
+    */
+    void put(uint64_t bits, int len) {
+        //make room in the accumulator by moving whole bytes to buf,
+        //at least one bit is left free so the shift in drain stays below 64
+        if (count + len >= 64) {
+            drain();
+        }
+        if (len != 0) {
+            acc |= bits << (64 - count - len);
+            count += len;
+        }
+    }
+
+    /*
+     * description: appends a code to the bitstream without making room for
+     *              it, for loops that drain after a fixed number of codes
+     * return: void (N/A)
+     * precondition: count + len is below 64, len is at least 1 and bits
+     *               has no set bits above len
+     * postcondition: the code is added after all previously written codes
+     *
+    */
+    void putUnchecked(uint64_t bits, int len) {
+        acc |= bits << (64 - count - len);
+        count += len;
+    }
+
+    /*
+     * description: moves every complete byte in the accumulator to buf
+     * return: void (N/A)
+     * precondition: none
+     * postcondition: fewer than 8 bits are left pending in acc
+     *
+    */
+    void drain() {
+        if (buf->size() < size + 8) {
+            buf->resize(buf->size() * 2 + 64);
+        }
+
+        //store all 8 bytes at once, only the complete ones are kept
+        uint64_t be = __builtin_bswap64(acc);
+        memcpy(&(*buf)[size], &be, sizeof(be));
+        size += count >> 3;
+        acc <<= (count & ~7);
+        count &= 7;
+    }
+
+    /*
+     * description: appends whole bytes to the bitstream
+     * return: void (N/A)
+     * precondition: no bits are pending, so the bitstream is byte aligned
+     * postcondition: the bytes are added after all previously written bytes
+     *
+    */
+    void putBytes(const void* bytes, size_t len) {
+        if (buf->size() < size + len) {
+            buf->resize(std::max(buf->size() * 2, size + len) + 64);
+        }
+        memcpy(&(*buf)[size], bytes, len);
+        size += len;
+    }
+
+    /*
+     * description: pads the last byte with zero bits and moves it to buf
+     * return: void (N/A)
+     * precondition: none
+     * postcondition: buf holds exactly the written bytes
+     *
+    */
+    void finish() {
+        drain();
+        if (count != 0) {
+            count = 8;
+            drain();
+        }
+        buf->resize(size);
+    }
+};
+
+//code lengths trained on a sample corpus, given to both the encoder and the
+//decoder so blocks only store the table's id instead of their own lengths
+struct shared_table {
+    unsigned char lengths[256]; //code length of each character, none are 0
+    uint64_t id; //hash of lengths that blocks refer to the table by
+
+    void train(const uint64_t freq[256]);
+};
+
+//code lengths of an order-1 block, which codes each character with the set
+//of lengths chosen by the character before it. Previous characters with
+//similar followers share a set, so the header stays small.
+struct context_model {
+    int numClusters; //number of sets of code lengths, 2 to maxContexts
+    unsigned char cluster[256]; //set of lengths each previous character selects
+    unsigned char lengths[maxContexts][256]; //code lengths of each set
+};
+
+//entry of the seek index written after the blocks
+struct block_index {
+    uint64_t offset; //position of the block's length field in the file
+    uint64_t tableBlock; //number of the block whose header holds the code
+    //lengths this block uses, the block itself unless it reuses them
+};
+
+//counters and phase timings of a compression or decompression, filled in
+//by encoders and decoders whose stats member points at it. Phase times of
+//blocks are summed, so with several threads they add up to more than the
+//wall time.
+struct huff_stats {
+    double readSeconds; //reading the source
+    double histogramSeconds; //counting characters
+    double buildSeconds; //building codes or decode tables
+    double headerSeconds; //writing or reading code lengths
+    double encodeSeconds; //encoding or decoding characters
+    double flushSeconds; //writing the destination
+    double totalSeconds; //wall time of the whole run
+    uint64_t bytesIn; //bytes read from the source
+    uint64_t bytesOut; //bytes written to the destination
+    uint64_t blocks; //number of blocks
+    uint64_t reusedTables; //blocks that reused the code lengths of the block before
+    uint64_t storedBlocks; //blocks kept as raw bytes since coding would not shrink them
+    uint64_t codedBits; //bits of encoded characters, headers not included
+    uint64_t freq[256]; //number of times each character was encoded
+    int maxCodeLen; //longest code used by any block
+    long peakMemoryKB; //peak resident memory of the process
+
+    huff_stats();
+    void add(const huff_stats& other);
+    double entropy() const;
+    std::string toLines() const;
+};
+
+void countBytes(const unsigned char* data, size_t size, uint64_t freq[256]);
+uint64_t estimateSize(const unsigned char* data, uint64_t size, size_t sourceBlockSize);
+void buildCodeLengths(const uint64_t freq[256], unsigned char lengths[256], int maxLen);
+void buildDecodeTable(const canonical_code& code, decode_entry* table);
+int multiTableBits(const canonical_code& code);
+void buildMultiTable(const canonical_code& code, int tableBits, multi_entry* multi);
+bool decodeStreams(const canonical_code& code, const decode_entry* table,
+                   const unsigned char* const* streams, const size_t* sizes,
+                   int numStreams, size_t count, std::string& out);
+bool decodeData(const canonical_code& code, const decode_entry* table,
+                const unsigned char* data, size_t size, size_t count, std::string& out);
+bool decodeMultiStreams(const canonical_code& code, const decode_entry* table,
+                        const multi_entry* multi, int tableBits,
+                        const unsigned char* const* streams, const size_t* sizes,
+                        int numStreams, size_t count, std::string& out);
+bool decodeContextStreams(const canonical_code* const* codes, const decode_entry* const* tables,
+                          const unsigned char cluster[256], const unsigned char* const* streams,
+                          const size_t* sizes, int numStreams, size_t count, std::string& out);
+size_t lengthHeaderSize(const unsigned char lengths[256]);
+void writeLengths(std::vector<unsigned char>& out, const unsigned char lengths[256]);
+bool readLengths(const unsigned char* data, size_t size, size_t& pos,
+                 unsigned char lengths[256]);
+int clusterContexts(const uint32_t* pairFreq, int maxClusters, unsigned char cluster[256],
+                    uint64_t clusterFreq[][256]);
+size_t contextHeaderSize(const context_model& model);
+void writeContextModel(std::vector<unsigned char>& out, const context_model& model);
+bool readContextModel(const unsigned char* data, size_t size, size_t& pos, context_model& model);
+void writeFileHeader(std::vector<unsigned char>& out, size_t sourceBlockSize, bool singleBlock);
+bool readFileHeader(const unsigned char* data, uint64_t size, size_t& sourceBlockSize);
+void writeFileTrailer(std::vector<unsigned char>& out, const std::vector<block_index>& index);
+bool readFileTrailer(const unsigned char* data, uint64_t size,
+                     std::vector<block_index>& index, uint64_t& blocksEnd);
+uint64_t tableId(const unsigned char lengths[256]);
+void writeTable(std::vector<unsigned char>& out, const shared_table& table);
+bool readTable(const unsigned char* data, size_t size, shared_table& table);
+bool blockTableId(const unsigned char* data, size_t size, uint64_t& id);
+bool readBlockLengths(const unsigned char* data, size_t size, const unsigned char* prevLengths,
+                      const shared_table* table, unsigned char lengths[256]);
+bool findBlock(const unsigned char* data, uint64_t blocksEnd, uint64_t offset,
+               const unsigned char*& block, size_t& len);
+
+//class used to compress blocks and whole buffers, reusable between calls
+class huff_encoder {
+public:
+    huff_stats* stats; //counters to add to, NULL to skip collecting them
+    const shared_table* sharedTable; //code lengths of every block, NULL to build
+    //them for each block
+    int numStreams; //interleaved bitstreams in each block, 1 to maxStreams
+    bool contextModel; //true to try an order-1 model on each block
+
+    huff_encoder();
+    void planBlock(const char* data, size_t size);
+    bool reuseLengths(const unsigned char prevLengths[256]);
+    const unsigned char* codeLengths() const;
+    void writeBlock(const char* data, size_t size, std::vector<unsigned char>& out);
+    void encodeBlock(const char* data, size_t size, std::vector<unsigned char>& out);
+    void compress(const char* data, size_t size, std::vector<unsigned char>& out,
+                  size_t sourceBlockSize = blockSize);
+
+private:
+    uint64_t freq[256]; //frequency of each character of the planned block
+    unsigned char lengths[256]; //code lengths the planned block is written with
+    bool reused; //true if lengths are those of the block before
+    bool contextual; //true if the planned block is written with model
+    bool stored; //true if the planned block is written as raw bytes
+    context_model model; //order-1 code lengths of the planned block, the
+    //first set is also in lengths
+    uint64_t contextBits; //bits of the planned block's characters with model
+    std::vector<uint32_t> pairFreq; //frequency of each character after each
+    //character, 256 * previous + next
+    canonical_code code; //the canonical code of the current block, the code
+    //of the first set of an order-1 block
+    std::vector<canonical_code> contextCodes; //codes of the other sets of an
+    //order-1 block
+    std::vector<block_index> index; //seek index entry of each block written by compress
+    std::vector<unsigned char> streamBufs[maxStreams]; //packed bytes of each
+    //stream of the current block
+
+    int blockStreams(size_t size) const;
+    bool storeRaw(size_t size) const;
+    bool planContexts(const char* data, size_t size);
+};
+
+//class used to decompress blocks and whole buffers, reusable between calls
+class huff_decoder {
+public:
+    huff_stats* stats; //counters to add to, NULL to skip collecting them
+    const shared_table* sharedTable; //table blocks written with one refer to, NULL
+    //if there is none
+
+    huff_decoder();
+    bool decodeBlock(const unsigned char* data, size_t size, std::string& out,
+                     const unsigned char* prevLengths = NULL);
+    bool decompress(const unsigned char* data, size_t size, std::string& out,
+                    uint64_t maxSize = UINT64_MAX);
+    bool extract(const unsigned char* data, size_t size, uint64_t offset, uint64_t length,
+                 std::string& out);
+    bool decodeLegacy(const unsigned char* data, size_t size, std::string& out);
+
+private:
+    canonical_code code; //the canonical code of the current block
+    bool haveCode; //true if code and table hold the code of the last block,
+    //kept from one buffer to the next so equal lengths skip the rebuild
+    bool chained; //true if the last block decoded can lend its lengths to the
+    //next, false at the start of a buffer and after a stored block
+    decode_entry table[1 << lookupBits]; //table used to decode lookupBits
+    //bits of the encoding at a time
+    int multiBits; //index bits of multiTable, 0 if code is not small enough
+    bool haveMulti; //true if multiTable holds the table of code
+    std::vector<multi_entry> multiTable; //multi-symbol table of code
+    context_model model; //code lengths of the last order-1 block
+    std::vector<canonical_code> contextCodes; //codes of the sets of an order-1
+    //block after the first, which is kept in code
+    std::vector<decode_entry> contextTables; //decode tables of contextCodes
+    node tree[maxTreeNodes]; //tree of the original encoding
+    std::vector<block_index> index; //seek index entry of each block read by
+    //decompress or extract
+};
+
+#endif
@@ -0,0 +1,537 @@
+/*
+ * File: huffmanBenchmark.cpp
+ * Description: Throughput benchmark for the Huffman encoding library. It builds
+ *     deterministic synthetic corpora and times each stage of the codec on its
+ *     own: histogramming, code construction, encoding and decoding. The original
+ *     string based -huff/-unhuff loops are timed on the same data as a baseline.
+ *     Results are printed as JSON so runs of different versions can be compared.
+ * Usage: huffmanBenchmark [-size <bytes>] [-reps <count>] [-baseline <bytes>]
+ *     [-o <file>]
+ */
+
+#include "huffman.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//a named corpus, split into records that are compressed on their own
+struct corpus {
+    string name; //name used in the results
+    vector<string> records; //the records of the corpus
+    size_t bytes; //total number of bytes in the records
+};
+
+//timing of one stage of the codec on one corpus
+struct stage_result {
+    string name; //name of the stage
+    double seconds; //best time over the repetitions
+    size_t bytes; //number of source bytes the stage covers
+};
+
+/*
+ * description: small deterministic random number generator, so every run
+ *              builds the same corpora on every platform
+ * return: the next 32-bit random number
+ * precondition: state is the generator state
+ * postcondition: state is advanced
+ *
+*/
+
+static uint32_t nextRandom(uint64_t& state) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return state >> 33;
+}
+
+/*
+ * description: builds English-like text from a fixed vocabulary with word
+ *              frequencies that fall off like natural language
+ * return: the text
+ * precondition: size is the number of bytes wanted
+ * postcondition: returns size bytes of text
+ *
+*/
+
+static string englishText(size_t size) {
+    static const char* words[] = {"the", "of", "and", "to", "in", "a", "is", "that",
+        "for", "it", "as", "was", "with", "be", "by", "on", "not", "he", "this",
+        "are", "or", "his", "from", "at", "which", "but", "have", "an", "had",
+        "they", "you", "were", "their", "one", "all", "we", "can", "her", "has",
+        "there", "been", "if", "more", "when", "will", "would", "who", "so",
+        "huffman", "encoding", "compression", "algorithm", "frequency", "tree"};
+    const int numWords = sizeof(words) / sizeof(words[0]); //number of words
+    uint64_t state = 1; //random state
+    string text; //the text being built
+
+    text.reserve(size + 16);
+    while (text.size() < size) {
+        //squaring a uniform number favours the first words
+        double r = (nextRandom(state) % 10000) / 10000.0;
+        text += words[(int)(r * r * numWords)];
+        text += (nextRandom(state) % 12 == 0) ? ".\n" : " ";
+    }
+    text.resize(size);
+    return text;
+}
+
+/*
+ * description: builds log lines with timestamps, a few levels and a few
+ *              repeated messages, so a handful of bytes dominate
+ * return: the log text
+ * precondition: size is the number of bytes wanted
+ * postcondition: returns size bytes of log text
+ *
+*/
+
+static string skewedLogs(size_t size) {
+    static const char* levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    static const char* messages[] = {"request served", "cache hit", "cache miss",
+        "connection opened", "connection closed", "retrying upstream"};
+    uint64_t state = 2; //random state
+    string text; //the text being built
+    char line[128]; //one log line
+
+    text.reserve(size + 128);
+    for (unsigned int t = 0; text.size() < size; t++) {
+        snprintf(line, sizeof(line), "2023-02-18T12:%02u:%02u.%03u %s id=%u %s\n",
+                 (t / 60000) % 60, (t / 1000) % 60, t % 1000,
+                 levels[nextRandom(state) % 6], nextRandom(state) % 1000,
+                 messages[nextRandom(state) % 6]);
+        text += line;
+    }
+    text.resize(size);
+    return text;
+}
+
+/*
+ * description: builds uniformly random bytes, which do not compress
+ * return: the bytes
+ * precondition: size is the number of bytes wanted
+ * postcondition: returns size random bytes
+ *
+*/
+
+static string uniformBytes(size_t size) {
+    uint64_t state = 3; //random state
+    string bytes(size, '\0'); //the bytes being built
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = nextRandom(state);
+    }
+    return bytes;
+}
+
+/*
+ * description: builds text of a few symbols, half of them the first two
+ *              symbols and the rest spread evenly, like DNA bases or hex dumps
+ * return: the text
+ * precondition: size is the number of bytes wanted, symbols has at least
+ *               two characters
+ * postcondition: returns size bytes of the symbols
+ *
+*/
+
+static string fewSymbols(size_t size, const string& symbols) {
+    uint64_t state = 4; //random state
+    string text(size, '\0'); //the text being built
+    for (size_t i = 0; i < size; i++) {
+        uint32_t r = nextRandom(state) % 100; //picks the symbol
+        text[i] = symbols[r < 50 ? r % 2 : r % symbols.size()];
+    }
+    return text;
+}
+
+/*
+ * description: builds every corpus of the benchmark
+ * return: the corpora
+ * precondition: size is the number of bytes in each corpus
+ * postcondition: returns the English, log, random, tiny, single-symbol, DNA
+ *                and hex corpora
+ *
+*/
+
+static vector<corpus> buildCorpora(size_t size) {
+    vector<corpus> corpora(7); //the corpora being built
+    string tiny = englishText(size); //text cut into tiny records
+
+    corpora[0].name = "english";
+    corpora[0].records.push_back(englishText(size));
+    corpora[1].name = "logs";
+    corpora[1].records.push_back(skewedLogs(size));
+    corpora[2].name = "uniform";
+    corpora[2].records.push_back(uniformBytes(size));
+    corpora[3].name = "tiny";
+    for (size_t pos = 0; pos < tiny.size(); pos += 256) {
+        corpora[3].records.push_back(tiny.substr(pos, 256));
+    }
+    corpora[4].name = "single";
+    corpora[4].records.push_back(string(size, 'a'));
+    corpora[5].name = "dna";
+    corpora[5].records.push_back(fewSymbols(size, "ACGT"));
+    corpora[6].name = "hex";
+    corpora[6].records.push_back(fewSymbols(size, "0123456789abcdef \n"));
+
+    for (size_t i = 0; i < corpora.size(); i++) {
+        corpora[i].bytes = 0;
+        for (size_t k = 0; k < corpora[i].records.size(); k++) {
+            corpora[i].bytes += corpora[i].records[k].size();
+        }
+    }
+    return corpora;
+}
+
+/*
+ * description: runs a stage several times and keeps the fastest run
+ * return: the fastest time in seconds
+ * precondition: reps is at least 1
+ * postcondition: stage has been called reps times
+ *
+*/
+
+static double timeStage(int reps, const function<void()>& stage) {
+    double best = 1e30; //fastest run so far
+    for (int r = 0; r < reps; r++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        stage();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        best = min(best, seconds);
+    }
+    return best;
+}
+
+/*
+ * description: the original -huff loop: a map histogram, a pointer tree,
+ *              string codes and string packing into bytes
+ * return: number of bytes the encoding packed, plus one bit of their xor
+ * precondition: text is the source
+ * postcondition: returns the size of the encoding and decodeTable holds the
+ *                string code of every character
+ *
+*/
+
+static size_t baselineEncode(const string& text, map<string, char>& decodeTable) {
+    //node of the pointer tree, freed at the end unlike the original
+    struct tree_node {
+        int count;
+        char c;
+        tree_node *left, *right;
+    };
+    struct cmp {
+        bool operator()(tree_node* a, tree_node* b) {
+            return a->count > b->count;
+        }
+    };
+    priority_queue<tree_node*, vector<tree_node*>, cmp> n; //queue of subtrees
+    vector<tree_node*> all; //every node, freed at the end
+    map<char, int> charMap; //frequency of each character
+    map<char, string> encodeTable; //code of each character
+
+    for (size_t i = 0; i < text.size(); i++) {
+        charMap[text[i]]++;
+    }
+    charMap.insert(pair<char, int>(eofChar, 1));
+    for (map<char, int>::iterator itr = charMap.begin(); itr != charMap.end(); itr++) {
+        all.push_back(new tree_node{itr->second, itr->first, NULL, NULL});
+        n.push(all.back());
+    }
+    while (n.size() > 1) {
+        tree_node* a = n.top(); //smallest subtree
+        n.pop();
+        tree_node* b = n.top(); //next smallest subtree
+        n.pop();
+        all.push_back(new tree_node{a->count + b->count, '\0', a, b});
+        n.push(all.back());
+    }
+
+    //string codes from the tree
+    function<void(tree_node*, string)> walk = [&](tree_node* p, string str) {
+        if (p->left == NULL) {
+            encodeTable[p->c] = str.empty() ? "0" : str;
+            decodeTable[str.empty() ? "0" : str] = p->c;
+            return;
+        }
+        walk(p->left, str + "0");
+        walk(p->right, str + "1");
+    };
+    walk(n.top(), "");
+
+    //pack the string codes into bytes 8 characters at a time
+    string encodString; //bits waiting to be packed
+    size_t numBytes = 0; //number of packed bytes
+    unsigned char check = 0; //xor of the packed bytes, keeps them from being optimized away
+    for (size_t i = 0; i <= text.size(); i++) {
+        encodString += encodeTable[i < text.size() ? text[i] : eofChar];
+        while (encodString.size() >= 8) {
+            unsigned char number = 0; //the packed byte
+            for (int k = 0; k < 8; k++) {
+                if (encodString[k] == '1') {
+                    number |= 1 << (7 - k);
+                }
+            }
+            check ^= number;
+            numBytes++;
+            encodString = encodString.substr(8);
+        }
+    }
+    for (size_t i = 0; i < all.size(); i++) {
+        delete all[i];
+    }
+    return numBytes + (check & 1);
+}
+
+/*
+ * description: expands text into the string of '0' and '1' characters the
+ *              original decoder read, so the baseline decode can time only
+ *              its lookup loop
+ * return: the encoding of text as a string of bits
+ * precondition: decodeTable was filled by baselineEncode from text
+ * postcondition: returns the bits of every character of text
+ *
+*/
+
+static string baselineBits(const string& text, const map<string, char>& decodeTable) {
+    map<char, string> codes; //code of each character
+    string bits; //the encoding as a string of bits
+
+    for (map<string, char>::const_iterator itr = decodeTable.begin(); itr != decodeTable.end(); itr++) {
+        codes[itr->second] = itr->first;
+    }
+    for (size_t i = 0; i < text.size(); i++) {
+        bits += codes[text[i]];
+    }
+    return bits;
+}
+
+/*
+ * description: the original -unhuff loop: one bit at a time appended to a
+ *              string that is looked up in a map after every bit
+ * return: number of decoded characters
+ * precondition: bits was built by baselineBits with the same decodeTable
+ * postcondition: returns the number of characters decoded
+ *
+*/
+
+static size_t baselineDecode(const string& bits, const map<string, char>& decodeTable) {
+    string readingString; //bits read since the last character
+    size_t numChars = 0; //number of decoded characters
+
+    for (size_t i = 0; i < bits.size(); i++) {
+        readingString = readingString + bits[i];
+        if (decodeTable.find(readingString) != decodeTable.end()) {
+            numChars++;
+            readingString = "";
+        }
+    }
+    return numChars;
+}
+
+/*
+ * description: times every stage of the library on one corpus. Encoding
+ *              only times writeBlock, the blocks are planned off the clock,
+ *              and every block is decoded and checked once before decoding
+ *              is timed.
+ * return: the timing of each stage
+ * precondition: c is a corpus, reps is at least 1, baselineBytes is the
+ *               number of bytes the slow baseline stages are run on
+ * postcondition: returns the histogram, code construction, encode and decode
+ *                timings, then the baseline timings. valid is false if a
+ *                block did not decode back to its source.
+ *
+*/
+
+static vector<stage_result> benchCorpus(const corpus& c, int reps, size_t baselineBytes,
+                                        size_t& compressedBytes, bool& valid) {
+    vector<stage_result> results; //timing of each stage
+    vector<const char*> chunks; //every block of every record
+    vector<size_t> chunkLens; //length of each block
+    vector<vector<uint64_t> > freqs; //histogram of each block
+    vector<vector<unsigned char> > encoded; //each block compressed
+    huff_encoder encoder; //encoder reused for every block
+    huff_decoder decoder; //decoder reused for every block
+    string decoded; //decoded block
+    volatile size_t sink = 0; //keeps results from being optimized away
+
+    for (size_t i = 0; i < c.records.size(); i++) {
+        for (size_t pos = 0; pos < c.records[i].size(); pos += blockSize) {
+            chunks.push_back(c.records[i].data() + pos);
+            chunkLens.push_back(min(blockSize, c.records[i].size() - pos));
+        }
+    }
+    freqs.assign(chunks.size(), vector<uint64_t>(256));
+    encoded.resize(chunks.size());
+
+    stage_result histogram = {"histogram", 0, c.bytes};
+    histogram.seconds = timeStage(reps, [&] {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            fill(freqs[i].begin(), freqs[i].end(), 0);
+            countBytes((const unsigned char*)chunks[i], chunkLens[i], freqs[i].data());
+        }
+    });
+    results.push_back(histogram);
+
+    stage_result build = {"build", 0, c.bytes};
+    build.seconds = timeStage(reps, [&] {
+        unsigned char lengths[256]; //code length of each character
+        canonical_code code; //the canonical code of the block
+        for (size_t i = 0; i < chunks.size(); i++) {
+            buildCodeLengths(freqs[i].data(), lengths, maxCodeLen);
+            code.assign(lengths);
+            sink += code.numSyms;
+        }
+    });
+    results.push_back(build);
+
+    //the histogram and code of each block were timed above, so planBlock
+    //runs off the clock and only writeBlock is timed
+    stage_result encode = {"encode", 1e30, c.bytes};
+    for (int r = 0; r < reps; r++) {
+        double seconds = 0; //time spent writing blocks in this run
+        for (size_t i = 0; i < chunks.size(); i++) {
+            encoded[i].clear();
+            encoder.planBlock(chunks[i], chunkLens[i]);
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            encoder.writeBlock(chunks[i], chunkLens[i], encoded[i]);
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+        encode.seconds = min(encode.seconds, seconds);
+    }
+    results.push_back(encode);
+
+    compressedBytes = 0;
+    for (size_t i = 0; i < encoded.size(); i++) {
+        compressedBytes += encoded[i].size();
+    }
+
+    //a decoder that fails would still have a throughput
+    valid = true;
+    for (size_t i = 0; i < chunks.size() && valid; i++) {
+        decoded.clear();
+        valid = decoder.decodeBlock(encoded[i].data() + 4, encoded[i].size() - 4, decoded) &&
+                decoded.compare(0, string::npos, chunks[i], chunkLens[i]) == 0;
+    }
+
+    stage_result decode = {"decode", 0, c.bytes};
+    decode.seconds = timeStage(reps, [&] {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            decoded.clear();
+            decoder.decodeBlock(encoded[i].data() + 4, encoded[i].size() - 4, decoded);
+            sink += decoded.size();
+        }
+    });
+    results.push_back(decode);
+
+    //the original loops are slow, so they only see the start of the corpus
+    string sample; //start of the corpus
+    for (size_t i = 0; i < c.records.size() && sample.size() < baselineBytes; i++) {
+        sample += c.records[i];
+    }
+    sample.resize(min(sample.size(), baselineBytes));
+    map<string, char> decodeTable; //string codes of the sample
+
+    stage_result baseEncode = {"baseline_encode", 0, sample.size()};
+    baseEncode.seconds = timeStage(1, [&] {
+        decodeTable.clear();
+        sink += baselineEncode(sample, decodeTable);
+    });
+    results.push_back(baseEncode);
+
+    string bits = baselineBits(sample, decodeTable); //the sample's bits as a string
+    stage_result baseDecode = {"baseline_decode", 0, sample.size()};
+    baseDecode.seconds = timeStage(1, [&] {
+        sink += baselineDecode(bits, decodeTable);
+    });
+    results.push_back(baseDecode);
+
+    return results;
+}
+
+/*
+ * description: main driver for the benchmark
+ * return: returns 0 as an exit code, 1 if an option is unknown or has no
+ *         value, the results file can't be written or a corpus does not
+ *         decode back to its source
+ * precondition: argc and argv represent the number of commands
+ *               and array that holds the commands respectively
+ * postcondition: the results are printed as JSON
+ *
+*/
+
+int main(int argc, char** argv) {
+    size_t size = 16 << 20; //bytes in each corpus
+    int reps = 5; //repetitions of each stage
+    size_t baselineBytes = 256 << 10; //bytes the baseline stages see
+    string outName; //results file, standard output if empty
+
+    for (int i = 1; i < argc; i += 2) {
+        string option = argv[i]; //name of the option
+        bool known = option == "-size" || option == "-reps" || option == "-baseline" ||
+                     option == "-o"; //true for an option the benchmark takes
+        if (!known || i + 1 >= argc) {
+            fprintf(stderr, "%s %s\n", known ? "Missing value for" : "Unknown option",
+                    option.c_str());
+            fprintf(stderr, "Usage: huffmanBenchmark [-size <bytes>] [-reps <count>] "
+                    "[-baseline <bytes>] [-o <file>]\n");
+            return 1;
+        }
+        if (option == "-size") {
+            size = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (option == "-reps") {
+            reps = max(1, atoi(argv[i + 1]));
+        }
+        else if (option == "-baseline") {
+            baselineBytes = strtoull(argv[i + 1], NULL, 10);
+        }
+        else if (option == "-o") {
+            outName = argv[i + 1];
+        }
+    }
+
+    FILE* out = outName.empty() ? stdout : fopen(outName.c_str(), "w"); //results file
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s\n", outName.c_str());
+        return 1;
+    }
+
+    vector<corpus> corpora = buildCorpora(size); //the corpora to time
+    fprintf(out, "{\n  \"format_version\": %d,\n  \"block_size\": %zu,\n", formatVersion, blockSize);
+    fprintf(out, "  \"reps\": %d,\n  \"corpora\": [\n", reps);
+    for (size_t i = 0; i < corpora.size(); i++) {
+        size_t compressedBytes = 0; //bytes of the compressed blocks
+        bool valid; //true if every block decoded back to its source
+        vector<stage_result> results = benchCorpus(corpora[i], reps, baselineBytes,
+                                                   compressedBytes, valid);
+        if (!valid) {
+            fprintf(stderr, "Corpus %s did not decode back to its source\n",
+                    corpora[i].name.c_str());
+            if (out != stdout) {
+                fclose(out);
+            }
+            return 1;
+        }
+
+        fprintf(out, "    {\"name\": \"%s\", \"bytes\": %zu, \"records\": %zu, "
+                "\"compressed_bytes\": %zu, \"stages\": {\n", corpora[i].name.c_str(),
+                corpora[i].bytes, corpora[i].records.size(), compressedBytes);
+        for (size_t k = 0; k < results.size(); k++) {
+            double seconds = max(results[k].seconds, 1e-9); //avoid dividing by zero
+            fprintf(out, "      \"%s\": {\"bytes\": %zu, \"seconds\": %.6f, "
+                    "\"mb_per_s\": %.2f, \"ns_per_byte\": %.3f}%s\n",
+                    results[k].name.c_str(), results[k].bytes, results[k].seconds,
+                    results[k].bytes / seconds / 1e6, seconds * 1e9 / max(results[k].bytes, (size_t)1),
+                    k + 1 < results.size() ? "," : "");
+        }
+        fprintf(out, "    }}%s\n", i + 1 < corpora.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
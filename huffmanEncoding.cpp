@@ -15,17 +15,35 @@
  *         abstracted for the source file.
  * Input:
  *         The program reads input in the format "-huff <source> <destination>
-           or "-unhuff <source> <destination>" from the command line.
+           or "-unhuff <source> <destination>" from the command line, optionally
+ *         followed by "-j <threads>" to spread the blocks across threads,
+ *         "-streams <n>" to split each block into n interleaved bitstreams,
+ *         "-b <bytes>" to set the block size, "-context" to code each character
+ *         with a table chosen by the character before it and "--stats" to print
+ *         phase timings and compression metrics. "-extract <source> <destination>
+ *         <offset> <length>" decompresses only the given range of the source, and
+ *         "-batch <manifest or directory> <destination directory>" compresses every
+ *         file listed in the manifest or found in the directory. "-train <corpus>
+ *         <table>" writes a code table trained on the corpus, which "-table
+ *         <table>" then shares between every block instead of each storing its own.
+ *         "-estimate <source>" estimates the compressed size from a sample, and
+ *         "-serve <socket>" compresses and decompresses payloads sent over a Unix
+ *         domain socket until it is interrupted.
  * Process:
  *         If huffing, characters are read from the text file and are used to create a
  *         Huffman tree. If the compressed file will have less bytes than the original
- *         file, it will start encrypting. First a magic number will be written to the
- *         the destination, along with the number of characters, the Huffman tree, and
- *         lastly the encryption. If unhuffing, the magic number is checked to ensure
- *         the file was encrypted by this program. If it was, it will begin decrypting
- *         by reading the data, constructing the Huffman tree, and reading in bytes
- *         that will be converting to an encryption string, which will be converted to
- *         characters.
+ *         file, it will keep the encryption. The source is split into fixed size blocks
+ *         that are compressed independently, so they can be spread across threads,
+ *         and a block coding would not shrink is stored as it is.
+ *         First a magic number, format version and block size will be written to the
+ *         destination, then each block with its number of characters, the code
+ *         length of each character (the canonical codes are rebuilt from the lengths)
+ *         and its encryption split into interleaved streams, and lastly the offset of
+ *         every block. If unhuffing, the magic number is checked to ensure the file
+ *         was encrypted by this program. If it was, it will begin decrypting each
+ *         block by reading its code lengths (or the character frequencies of files
+ *         from the original version, which are used to rebuild the Huffman tree), and
+ *         decoding the bytes with a decode table.
  * Output:
  *         Outputs error messages if the file can not be compressed or if it was not
  *         encrypted using this program. Otherwise, no direct output, but the correct
@@ -37,160 +55,1942 @@
  *         "-huff <source> <destination> or "-unhuff <source> <destination>".
  */
 
+#include "huffman.h"
 #include <iostream>
-#include <queue>
-#include <map>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <cerrno>
+#include <chrono>
+#include <deque>
 #include <fstream>
+#include <map>
+#ifdef HUFF_IO_URING
+#include <liburing.h>
+#endif
+
+using namespace std;
+
+//class used to run the same task for many blocks across several threads
+class thread_pool {
+public:
+    thread_pool(int numThreads);
+    ~thread_pool();
+    void run(size_t newCount, const function<void(size_t)>& newTask);
+
+private:
+    vector<thread> workers; //threads other than the one calling run
+    mutex lock; //protects every member below
+    condition_variable wake; //signals workers that a run started or the pool stops
+    condition_variable done; //signals run that every task finished
+    const function<void(size_t)>* task; //task of the current run
+    size_t count; //number of tasks in the current run
+    size_t next; //next task to start
+    size_t finished; //number of finished tasks
+    unsigned int generation; //number of runs started so far
+    bool stopping; //true once the pool is being destroyed
+
+    void runTasks();
+    void work();
+};
+
+const size_t outputBufferSize = 4 << 20; //bytes gathered before each write
+const size_t inputChunkSize = 1 << 20; //bytes of each read of a file that
+//is not mapped
+const int ioDepth = 3; //buffers a file cycles through, the caller fills or
+//drains one while the others are read or written in the background
+
+//class used to read or write chunks of a file in the background, in the
+//order they were submitted, so the caller can compute in the meantime.
+//Built with HUFF_IO_URING the transfers go through io_uring when a ring can
+//be set up, otherwise through a thread of their own.
+class io_queue {
+public:
+    io_queue();
+    ~io_queue();
+    bool started() const;
+    void start(int newFd, bool newReading);
+    void submit(char* data, size_t len);
+    ssize_t wait();
+    void stop();
+
+private:
+    //a read or write of one chunk
+    struct transfer {
+        char* data; //the chunk
+        size_t len; //bytes to write, or room to read into
+        size_t done; //bytes moved so far
+        ssize_t result; //bytes moved once finished, -1 after an error
+        bool finished; //true once the transfer is over
+    };
+
+    int fd; //descriptor the chunks move through, -1 before start
+    bool reading; //true to read chunks, false to write them
+    deque<transfer> pending; //transfers not waited for yet, oldest first
+    thread worker; //thread doing the transfers when there is no ring
+    mutex lock; //protects pending and stopping while the worker runs
+    condition_variable changed; //signals a submitted or finished transfer
+    bool stopping; //true once the worker should exit
+#ifdef HUFF_IO_URING
+    struct io_uring ring; //submission and completion queues
+    bool ringReady; //false if the ring could not be set up, the worker
+    //thread then does the transfers
+    bool inFlight; //true while the oldest unfinished transfer is in the ring
+
+    void pump(bool block);
+#endif
+    void work();
+};
+
+//class used to read a file in place through a memory mapping, with reads
+//ahead of the caller for anything that can not be mapped
+class input_file {
+public:
+    input_file();
+    ~input_file();
+    bool open(const string& name);
+    const char* next(size_t len, vector<char>& buf, size_t& got);
+    const unsigned char* all(vector<char>& buf, uint64_t& size);
+    const unsigned char* mapping(uint64_t& size) const;
+
+private:
+    int fd; //descriptor of the open file, -1 if not open
+    const char* map; //the mapped file, NULL if it is read instead
+    uint64_t mapSize; //number of mapped bytes
+    uint64_t pos; //position of the next byte given out of the mapping
+    io_queue queue; //reads chunks ahead of the caller
+    vector<char> chunks[ioDepth]; //chunks being read or drained
+    int current; //chunk being drained
+    size_t chunkPos; //next byte of the current chunk to give out
+    size_t chunkLen; //number of bytes in the current chunk
+    bool ended; //true once a read found the end of the file
+
+    bool refill();
+};
+
+//class used to write a file through large buffers, written in the
+//background while the next one fills
+class output_file {
+public:
+    output_file();
+    ~output_file();
+    bool open(const string& name);
+    void write(const void* bytes, size_t len);
+    void flush();
+    bool close();
+
+private:
+    int fd; //descriptor of the open file, -1 if not open
+    bool failed; //true once a write has failed
+    io_queue queue; //writes full buffers in the background
+    vector<char> chunks[ioDepth]; //buffers being filled or written
+    int current; //buffer being filled
+    int outstanding; //number of buffers submitted and not waited for
+
+    void writeAll(const char* bytes, size_t len);
+};
+
+//class used to compress whole files a window of blocks at a time, keeping
+//its encoders and buffers from one file to the next
+class file_compressor {
+public:
+    file_compressor(thread_pool& newPool, size_t newWindow, int numStreams, bool contextModel,
+                    const shared_table* table, size_t newBlockSize,
+                    vector<huff_stats>* slotStats);
+    bool compress(const string& iFileName, const string& oFileName, ostream& msg,
+                  huff_stats& stats);
+
+private:
+    thread_pool& pool; //threads blocks are spread across
+    size_t window; //number of blocks in memory at once
+    size_t sourceBlockSize; //number of source bytes in each block
+    vector<vector<char> > buffers; //buffers for blocks that are read instead
+    //of mapped, each is reused for every window
+    vector<const char*> blocks; //source blocks of the window
+    vector<size_t> blockLens; //number of bytes in each block
+    vector<huff_encoder> encoders; //encoder of each block in the window
+    vector<vector<unsigned char> > encoded; //the compressed blocks
+    vector<block_index> index; //seek index entry of each block
+    vector<unsigned char> bytes; //header or trailer of the binary file
+};
+
+const size_t batchLargeBlocks = 8; //batch files of more blocks are split
+//across threads, smaller ones are grouped
+const size_t requestHeaderSize = 9; //operation(1) and payload length(8) of a
+//-serve request
+const size_t replyHeaderSize = 17; //status(1), server nanoseconds(8) and payload
+//length(8) of a -serve reply
+const size_t maxRequestSize = maxBlockSize; //largest payload -serve accepts
+const int latencyBuckets = 512; //buckets of a latency histogram, 8 for each
+//power of two nanoseconds
+const int stopCheckMillis = 250; //how often waiting -serve workers check for a stop
+const int stallMillis = 10000; //a -serve connection that stops sending or taking
+//bytes in the middle of a request is dropped after this long
+const int idleMillis = 60000; //a -serve connection that sends no request for this
+//long is closed
+
+//state of one -serve worker, kept from one request to the next so its
+//buffers stay allocated and its decode tables stay built
+struct server_slot {
+    huff_encoder encoder; //compresses payloads
+    huff_decoder decoder; //decompresses payloads
+    vector<char> request; //payload of the current request
+    vector<unsigned char> compressed; //reply to a compress request
+    string decoded; //reply to a decompress request
+    uint64_t requests; //number of requests served
+    uint64_t bytesIn; //payload bytes received
+    uint64_t bytesOut; //payload bytes sent back
+    uint64_t latency[latencyBuckets]; //number of requests in each latency bucket
+    uint64_t maxLatency; //slowest request in nanoseconds
+};
+
+//connections of -serve passed between the thread polling them and the
+//workers serving their requests
+struct server_queue {
+    mutex lock; //protects ready, served and closing
+    condition_variable changed; //signals a ready connection or the stop
+    deque<int> ready; //connections with a request waiting, oldest first
+    vector<int> served; //connections whose request was answered, to be polled again
+    bool closing; //true once the server is stopping, workers then exit
+    int wakeFds[2]; //pipe written to wake the poller when a connection is served
+};
+
+/*
+ * description: constructor for the thread pool
+ * return: none
+ * precondition: numThreads is at least 1
+ * postcondition: starts numThreads - 1 workers, the thread calling run
+ *                is the last worker
+ *
+*/
+
+thread_pool::thread_pool(int numThreads) {
+    task = NULL;
+    count = 0;
+    next = 0;
+    finished = 0;
+    generation = 0;
+    stopping = false;
+
+    for (int i = 1; i < numThreads; i++) {
+        workers.push_back(thread(&thread_pool::work, this));
+    }
+}
+
+/*
+ * description: destructor for the thread pool
+ * return: none
+ * precondition: no run is in progress
+ * postcondition: every worker has exited
+ *
+*/
+
+thread_pool::~thread_pool() {
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+/*
+ * description: calls newTask(i) for every i below newCount, spread across
+ *              the workers and the calling thread
+ * return: void (N/A)
+ * precondition: newTask is safe to call from several threads at once
+ * postcondition: every call has returned
+ *
+*/
+
+void thread_pool::run(size_t newCount, const function<void(size_t)>& newTask) {
+    {
+        lock_guard<mutex> guard(lock);
+        task = &newTask;
+        count = newCount;
+        next = 0;
+        finished = 0;
+        generation++;
+    }
+    wake.notify_all();
+    runTasks();
+
+    unique_lock<mutex> guard(lock);
+    done.wait(guard, [&] { return finished == count; });
+    task = NULL;
+}
+
+/*
+ * description: runs tasks of the current run until none are left
+ * return: void (N/A)
+ * precondition: a run is in progress
+ * postcondition: every task has been started by some thread
+ *
+*/
+
+void thread_pool::runTasks() {
+    unique_lock<mutex> guard(lock);
+    while (next < count) {
+        size_t index = next++; //task taken by this thread
+        const function<void(size_t)>* current = task; //task of this run
+        guard.unlock();
+        (*current)(index);
+        guard.lock();
+        if (++finished == count) {
+            done.notify_all();
+        }
+    }
+}
+
+/*
+ * description: main loop of a worker, waits for a run and helps with it
+ * return: void (N/A)
+ * precondition: none
+ * postcondition: returns once the pool is stopping
+ *
+*/
+
+void thread_pool::work() {
+    unsigned int seen = 0; //last run this worker took part in
+    while (true) {
+        {
+            unique_lock<mutex> guard(lock);
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        runTasks();
+    }
+}
+
+/*
+ * description: default constructor for the input file
+ * return: none
+ * precondition: none
+ * postcondition: creates an input file that is not open
+ *
+*/
+
+input_file::input_file() {
+    fd = -1;
+    map = NULL;
+    mapSize = 0;
+    pos = 0;
+    current = 0;
+    chunkPos = 0;
+    chunkLen = 0;
+    ended = false;
+}
+
+/*
+ * description: destructor for the input file
+ * return: none
+ * precondition: none
+ * postcondition: the mapping and descriptor are released
+ *
+*/
+
+input_file::~input_file() {
+    queue.stop();
+    if (map != NULL) {
+        munmap((void*)map, mapSize);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+/*
+ * description: opens a file for reading, "-" reads standard input. Regular
+ *              files are memory mapped so their bytes are used in place,
+ *              anything else (such as a pipe) is read a few chunks ahead of
+ *              the caller and copied into the caller's buffers.
+ * return: true if the file was opened, false otherwise
+ * precondition: the input file is not open yet
+ * postcondition: reading starts at the first byte of the file
+ *
+*/
+
+bool input_file::open(const string& name) {
+    struct stat info; //type and size of the file
+
+    if (name == "-") {
+        fd = dup(STDIN_FILENO);
+        return fd >= 0;
+    }
+    fd = ::open(name.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size == 0) {
+        ended = true;
+    }
+    if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* addr = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            map = (const char*)addr;
+            mapSize = info.st_size;
+            madvise(addr, mapSize, MADV_SEQUENTIAL);
+        }
+    }
+    return true;
+}
+
+/*
+ * description: reads the next len bytes of the file, or fewer at the end.
+ *              A mapped file returns a pointer into the mapping and leaves
+ *              buf alone, and asks the kernel to start reading the len bytes
+ *              after them, so the next call finds them in memory. Otherwise
+ *              the bytes are copied into buf from the chunks read ahead.
+ * return: pointer to the bytes read, valid while the file is open and buf
+ *         is not changed
+ * precondition: the file is open
+ * postcondition: got holds the number of bytes read, 0 at the end of the file
+ *
+*/
+
+const char* input_file::next(size_t len, vector<char>& buf, size_t& got) {
+    if (map != NULL) {
+        got = min((uint64_t)len, mapSize - pos);
+        pos += got;
+
+        //madvise needs a page aligned start
+        uint64_t ahead = pos & ~(uint64_t)(sysconf(_SC_PAGESIZE) - 1); //start of the next range
+        if (ahead < mapSize) {
+            madvise((void*)(map + ahead), min((uint64_t)len, mapSize - ahead), MADV_WILLNEED);
+        }
+        return map + pos - got;
+    }
+
+    //keep copying until len bytes arrive or the end of the file
+    buf.resize(len);
+    got = 0;
+    while (got < len && (chunkPos < chunkLen || refill())) {
+        size_t n = min(len - got, chunkLen - chunkPos); //bytes from this chunk
+        memcpy(buf.data() + got, chunks[current].data() + chunkPos, n);
+        chunkPos += n;
+        got += n;
+    }
+    return buf.data();
+}
+
+/*
+ * description: moves on to the next chunk read ahead, handing the drained
+ *              one back to the queue to be read into again. The first call
+ *              starts reading ioDepth chunks.
+ * return: true if the next chunk holds bytes, false at the end of the file
+ *         or after a failed read
+ * precondition: the file is open and not mapped, the current chunk is drained
+ * postcondition: the current chunk holds the next bytes of the file
+ *
+*/
+
+bool input_file::refill() {
+    if (ended) {
+        return false;
+    }
+    if (!queue.started()) {
+        queue.start(fd, true);
+        for (int k = 0; k < ioDepth; k++) {
+            chunks[k].resize(inputChunkSize);
+            queue.submit(chunks[k].data(), inputChunkSize);
+        }
+        current = ioDepth - 1;
+    }
+    else {
+        queue.submit(chunks[current].data(), inputChunkSize);
+    }
+
+    //chunks are read in order, so the oldest read is the next chunk
+    current = (current + 1) % ioDepth;
+    ssize_t n = queue.wait(); //bytes read into the chunk
+    chunkPos = 0;
+    chunkLen = n > 0 ? n : 0;
+    ended = chunkLen == 0;
+    return !ended;
+}
+
+/*
+ * description: gives the rest of the file as one range of bytes, using the
+ *              mapping when there is one and reading into buf otherwise
+ * return: pointer to the first byte not read yet
+ * precondition: the file is open
+ * postcondition: size holds the number of bytes left in the file
+ *
+*/
+
+const unsigned char* input_file::all(vector<char>& buf, uint64_t& size) {
+    if (map != NULL) {
+        size = mapSize - pos;
+        pos = mapSize;
+        return (const unsigned char*)map + pos - size;
+    }
+
+    size_t got; //bytes read by the last call to next
+    vector<char> chunk; //buffer for each chunk of the file
+    buf.clear();
+    do {
+        const char* bytes = next(blockSize, chunk, got);
+        buf.insert(buf.end(), bytes, bytes + got);
+    } while (got != 0);
+    size = buf.size();
+    return (const unsigned char*)buf.data();
+}
+
+/*
+ * description: gives the rest of a mapped file without reading past it, so
+ *              it can be looked over before it is read
+ * return: pointer to the first byte not read yet, NULL if the file is not
+ *         mapped
+ * precondition: the file is open
+ * postcondition: size holds the number of bytes left in a mapped file
+ *
+*/
+
+const unsigned char* input_file::mapping(uint64_t& size) const {
+    if (map == NULL) {
+        return NULL;
+    }
+    size = mapSize - pos;
+    return (const unsigned char*)map + pos;
+}
+
+/*
+ * description: default constructor for the output file
+ * return: none
+ * precondition: none
+ * postcondition: creates an output file that is not open
+ *
+*/
+
+output_file::output_file() {
+    fd = -1;
+    failed = false;
+    current = 0;
+    outstanding = 0;
+}
+
+/*
+ * description: destructor for the output file
+ * return: none
+ * precondition: none
+ * postcondition: buffered bytes are written and the file is closed
+ *
+*/
+
+output_file::~output_file() {
+    close();
+}
+
+/*
+ * description: creates or truncates a file for writing, "-" writes to
+ *              standard output
+ * return: true if the file was opened, false otherwise
+ * precondition: the output file is not open yet
+ * postcondition: writing starts at the first byte of the file
+ *
+*/
+
+bool output_file::open(const string& name) {
+    if (name == "-") {
+        fd = dup(STDOUT_FILENO);
+    }
+    else {
+        fd = ::open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    return fd >= 0;
+}
+
+/*
+ * description: appends bytes to the file. The bytes are gathered in a
+ *              large buffer, which is handed to the queue once full. The
+ *              first buffer grows with the file, so a small file only
+ *              allocates its own size. Once one has filled, the rest are
+ *              reserved whole.
+ * return: void (N/A)
+ * precondition: the file is open
+ * postcondition: the bytes follow every previously written byte
+ *
+*/
+
+void output_file::write(const void* bytes, size_t len) {
+    const char* src = (const char*)bytes; //next byte to gather
+    while (len > 0) {
+        if (queue.started() && chunks[current].capacity() < outputBufferSize) {
+            chunks[current].reserve(outputBufferSize);
+        }
+        size_t n = min(len, outputBufferSize - chunks[current].size()); //bytes that fit
+        chunks[current].insert(chunks[current].end(), src, src + n);
+        src += n;
+        len -= n;
+        if (chunks[current].size() == outputBufferSize) {
+            flush();
+        }
+    }
+}
+
+/*
+ * description: hands the buffered bytes to the queue to be written in the
+ *              background and moves on to the next buffer, waiting for that
+ *              one's write first if every buffer is in flight
+ * return: void (N/A)
+ * precondition: the file is open
+ * postcondition: the current buffer is empty
+ *
+*/
+
+void output_file::flush() {
+    if (chunks[current].empty()) {
+        return;
+    }
+    if (!queue.started()) {
+        queue.start(fd, false);
+    }
+    queue.submit(chunks[current].data(), chunks[current].size());
+    outstanding++;
+    current = (current + 1) % ioDepth;
+
+    //buffers are written in order, so the oldest write is the next buffer's
+    if (outstanding == ioDepth) {
+        failed |= queue.wait() < 0;
+        outstanding--;
+    }
+    chunks[current].clear();
+}
+
+/*
+ * description: writes what is left and closes the file. A file that never
+ *              filled a buffer is written directly, so small files don't
+ *              start a queue.
+ * return: true if every byte was written, false otherwise
+ * precondition: none
+ * postcondition: the file is closed
+ *
+*/
+
+bool output_file::close() {
+    if (fd >= 0) {
+        if (!queue.started()) {
+            writeAll(chunks[current].data(), chunks[current].size());
+            chunks[current].clear();
+        }
+        else {
+            flush();
+            for (; outstanding > 0; outstanding--) {
+                failed |= queue.wait() < 0;
+            }
+            queue.stop();
+        }
+        failed |= ::close(fd) != 0;
+        fd = -1;
+    }
+    return !failed;
+}
+
+/*
+ * description: writes bytes to the file, retrying short writes
+ * return: void (N/A)
+ * precondition: the file is open
+ * postcondition: every byte was written, or failed is set
+ *
+*/
+
+void output_file::writeAll(const char* bytes, size_t len) {
+    while (len > 0 && !failed) {
+        ssize_t n = ::write(fd, bytes, len); //bytes from this write
+        if (n <= 0) {
+            failed = true;
+            break;
+        }
+        bytes += n;
+        len -= n;
+    }
+}
+
+/*
+ * description: moves one chunk through fd, retrying interrupted calls.
+ *              Writes continue until the whole chunk is written, reads until
+ *              it is full or the end of the file.
+ * return: number of bytes moved, -1 if a call failed
+ * precondition: fd is open for reading or writing
+ * postcondition: the chunk is written, or read into
+ *
+*/
+
+static ssize_t moveChunk(int fd, bool reading, char* data, size_t len) {
+    size_t done = 0; //bytes moved so far
+    while (done < len) {
+        ssize_t n = reading ? read(fd, data + done, len - done)
+                            : ::write(fd, data + done, len - done); //bytes from this call
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 || (n == 0 && !reading)) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+/*
+ * description: default constructor for the queue
+ * return: none
+ * precondition: none
+ * postcondition: creates a queue that is not started
+ *
+*/
+
+io_queue::io_queue() {
+    fd = -1;
+    reading = false;
+    stopping = false;
+#ifdef HUFF_IO_URING
+    ringReady = false;
+    inFlight = false;
+#endif
+}
+
+/*
+ * description: destructor for the queue
+ * return: none
+ * precondition: none
+ * postcondition: every submitted transfer is finished and the queue stopped
+ *
+*/
+
+io_queue::~io_queue() {
+    stop();
+}
+
+/*
+ * description: tells if the queue was started
+ * return: true if start was called and stop was not, false otherwise
+ * precondition: none
+ * postcondition: none
+ *
+*/
+
+bool io_queue::started() const {
+    return fd >= 0;
+}
+
+/*
+ * description: starts moving chunks through a descriptor
+ * return: void (N/A)
+ * precondition: the queue is not started, newFd stays open until stop
+ * postcondition: submitted chunks are read from or written to newFd
+ *
+*/
+
+void io_queue::start(int newFd, bool newReading) {
+    fd = newFd;
+    reading = newReading;
+#ifdef HUFF_IO_URING
+    //one transfer is in the ring at a time, so they happen in order even
+    //on pipes
+    ringReady = io_uring_queue_init(ioDepth, &ring, 0) == 0;
+    if (ringReady) {
+        return;
+    }
+#endif
+    stopping = false;
+    worker = thread(&io_queue::work, this);
+}
+
+/*
+ * description: submits a chunk to be read into or written in the
+ *              background, after every chunk submitted before it
+ * return: void (N/A)
+ * precondition: the queue is started, data stays valid until the chunk is
+ *               waited for
+ * postcondition: the transfer is queued
+ *
+*/
+
+void io_queue::submit(char* data, size_t len) {
+    transfer t = {data, len, 0, 0, false}; //the new transfer
+#ifdef HUFF_IO_URING
+    if (ringReady) {
+        pending.push_back(t);
+        pump(false);
+        return;
+    }
+#endif
+    lock_guard<mutex> guard(lock);
+    pending.push_back(t);
+    changed.notify_all();
+}
+
+/*
+ * description: waits for the oldest submitted chunk to be moved
+ * return: number of bytes moved, less than submitted only for a read that
+ *         reached the end of the file, -1 if the transfer failed
+ * precondition: a chunk was submitted and not waited for
+ * postcondition: the chunk is no longer in the queue
+ *
+*/
+
+ssize_t io_queue::wait() {
+    ssize_t result; //result of the oldest transfer
+#ifdef HUFF_IO_URING
+    if (ringReady) {
+        pump(true);
+        result = pending.front().result;
+        pending.pop_front();
+        return result;
+    }
+#endif
+    unique_lock<mutex> guard(lock);
+    changed.wait(guard, [&] { return pending.front().finished; });
+    result = pending.front().result;
+    pending.pop_front();
+    return result;
+}
+
+/*
+ * description: finishes every submitted transfer and stops the queue
+ * return: void (N/A)
+ * precondition: none
+ * postcondition: the queue is not started and holds no transfers
+ *
+*/
+
+void io_queue::stop() {
+    if (fd < 0) {
+        return;
+    }
+#ifdef HUFF_IO_URING
+    if (ringReady) {
+        while (!pending.empty()) {
+            wait();
+        }
+        io_uring_queue_exit(&ring);
+        ringReady = false;
+        fd = -1;
+        return;
+    }
+#endif
+    {
+        lock_guard<mutex> guard(lock);
+        stopping = true;
+        changed.notify_all();
+    }
+    worker.join();
+    pending.clear();
+    fd = -1;
+}
+
+#ifdef HUFF_IO_URING
+/*
+ * description: moves the oldest unfinished transfer along: reaps its
+ *              completion if one is ready (or waits for it if block is
+ *              true), resubmits the rest of a short transfer, and puts the
+ *              next unfinished transfer in the ring
+ * return: void (N/A)
+ * precondition: the queue is started
+ * postcondition: if block is true, the oldest transfer is finished
+ *
+*/
+
+void io_queue::pump(bool block) {
+    for (;;) {
+        transfer* t = NULL; //oldest unfinished transfer
+        for (size_t i = 0; i < pending.size() && t == NULL; i++) {
+            if (!pending[i].finished) {
+                t = &pending[i];
+            }
+        }
+        if (t == NULL || (block && pending.front().finished)) {
+            return;
+        }
+
+        if (!inFlight) {
+            struct io_uring_sqe* sqe = io_uring_get_sqe(&ring); //entry of the transfer
+            if (reading) {
+                io_uring_prep_read(sqe, fd, t->data + t->done, t->len - t->done, -1);
+            }
+            else {
+                io_uring_prep_write(sqe, fd, t->data + t->done, t->len - t->done, -1);
+            }
+            io_uring_submit(&ring);
+            inFlight = true;
+        }
+
+        struct io_uring_cqe* cqe; //completion of the transfer
+        int ready = block ? io_uring_wait_cqe(&ring, &cqe) : io_uring_peek_cqe(&ring, &cqe); //0
+        //once a completion is ready
+        if (ready == -EINTR || ready == -EAGAIN) {
+            if (block) {
+                continue;
+            }
+            return;
+        }
+        if (ready != 0) {
+            t->result = -1;
+            t->finished = true;
+            inFlight = false;
+            continue;
+        }
+        int res = cqe->res; //bytes moved, or a negative error
+        io_uring_cqe_seen(&ring, cqe);
+        inFlight = false;
+
+        //a short transfer is resubmitted for the rest, like moveChunk
+        if (res == -EINTR || res == -EAGAIN) {
+            continue;
+        }
+        if (res < 0 || (res == 0 && !reading)) {
+            t->result = -1;
+            t->finished = true;
+            continue;
+        }
+        t->done += res;
+        if (res == 0 || t->done == t->len) {
+            t->result = t->done;
+            t->finished = true;
+        }
+    }
+}
+#endif
+
+/*
+ * description: runs on the queue's own thread, moving each submitted chunk
+ *              in order until the queue stops
+ * return: void (N/A)
+ * precondition: start created the thread
+ * postcondition: every chunk submitted before stop has been moved
+ *
+*/
+
+void io_queue::work() {
+    unique_lock<mutex> guard(lock);
+    for (;;) {
+        transfer* t = NULL; //oldest unfinished transfer
+        for (size_t i = 0; i < pending.size() && t == NULL; i++) {
+            if (!pending[i].finished) {
+                t = &pending[i];
+            }
+        }
+        if (t == NULL) {
+            if (stopping) {
+                return;
+            }
+            changed.wait(guard);
+            continue;
+        }
+
+        //the caller leaves a submitted chunk alone until it is finished
+        guard.unlock();
+        ssize_t result = moveChunk(fd, reading, t->data, t->len); //bytes moved
+        guard.lock();
+        t->result = result;
+        t->finished = true;
+        changed.notify_all();
+    }
+}
+
+/*
+ * description: finds the seconds since start
+ * return: seconds since start
+ * precondition: start was set by steady_clock::now
+ * postcondition: none
+ *
+*/
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * description: adds the stats of every block slot to total, fills in the
+ *              run-wide values and prints the result to stderr, so it does
+ *              not mix with anything written to stdout
+ * return: void (N/A)
+ * precondition: slots are the stats the encoders or decoders added to
+ * postcondition: total holds the stats of the whole run and they are printed
+ *
+*/
+
+static void reportStats(huff_stats& total, const vector<huff_stats>& slots,
+                        chrono::steady_clock::time_point start) {
+    struct rusage usage; //resource usage of the process
+
+    for (size_t i = 0; i < slots.size(); i++) {
+        total.add(slots[i]);
+    }
+    total.totalSeconds = secondsSince(start);
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        total.peakMemoryKB = usage.ru_maxrss;
+    }
+    cerr << total.toLines();
+}
+
+/*
+ * description: constructor for the file compressor
+ * return: none
+ * precondition: newPool and table outlive the compressor, table is NULL
+ *               to build the code of each block, slotStats is NULL or has
+ *               newWindow entries
+ * postcondition: creates a compressor with newWindow encoders, which try
+ *                order-1 models if contextModel is true and add to
+ *                slotStats if it is not NULL
+ *
+*/
+
+file_compressor::file_compressor(thread_pool& newPool, size_t newWindow, int numStreams,
+                                 bool contextModel, const shared_table* table,
+                                 size_t newBlockSize,
+                                 vector<huff_stats>* slotStats)
+    : pool(newPool), buffers(newWindow), blocks(newWindow), blockLens(newWindow),
+      encoders(newWindow), encoded(newWindow) {
+    window = newWindow;
+    sourceBlockSize = newBlockSize;
+    for (size_t i = 0; i < window; i++) {
+        encoders[i].numStreams = numStreams;
+        encoders[i].contextModel = contextModel;
+        encoders[i].sharedTable = table;
+        if (slotStats != NULL) {
+            encoders[i].stats = &(*slotStats)[i];
+        }
+    }
+}
+
+/*
+ * description: compresses one file, reading a window of blocks at a time,
+ *              compressing them together and writing them in order
+ * return: true if the compressed file was written and kept, false if it
+ *         could not be or would be larger than the source
+ * precondition: none
+ * postcondition: problems are reported on msg, the phase times and sizes
+ *                are added to stats
+ *
+*/
+
+bool file_compressor::compress(const string& iFileName, const string& oFileName, ostream& msg,
+                               huff_stats& stats) {
+    uint64_t numByteOrig = 0; //number of bytes in original file
+    uint64_t numByteComp = fileHeaderSize; //number of bytes in binary file,
+    //the trailer after the blocks is added last
+    input_file source; //the source file, mapped when possible
+    output_file dest; //the binary file
+    unsigned char prevLengths[256]; //code lengths of the last block written
+    chrono::steady_clock::time_point phase; //start of the phase being timed
+
+    index.clear();
+    if (!source.open(iFileName)) {
+        msg << "Could not open " << iFileName << endl;
+        return false;
+    }
+
+    //a mapped source is sampled first, so one that won't shrink is given up
+    //on before any of it is coded. Standard output still gets stored blocks.
+    //The estimate prices each block's own order-0 code, so it says nothing
+    //about a shared table (which saves the length header) or order-1 models.
+    uint64_t mappedSize = 0; //number of bytes in the mapped source
+    const unsigned char* mapped = source.mapping(mappedSize); //the source, NULL if read
+    bool ownCodes = encoders[0].sharedTable == NULL && !encoders[0].contextModel; //true if
+    //blocks are written with the code the estimate prices
+    if (mapped != NULL && oFileName != "-" && ownCodes &&
+        estimateSize(mapped, mappedSize, sourceBlockSize) >= mappedSize) {
+        msg << iFileName << ": File will not compress" << endl;
+        return false;
+    }
+    if (!dest.open(oFileName)) {
+        msg << "Could not open " << oFileName << endl;
+        return false;
+    }
+
+    //read a window of blocks, compress them together, write them in order
+    bool more = true; //false once the end of the source is reached
+    bool singleBlock = false; //true if the whole source fits in the first block
+    while (more) {
+        size_t numBlocks = 0; //number of blocks read into this window
+        phase = chrono::steady_clock::now();
+        while (numBlocks < window) {
+            blocks[numBlocks] = source.next(sourceBlockSize, buffers[numBlocks],
+                                            blockLens[numBlocks]);
+            if (blockLens[numBlocks] == 0) {
+                more = false;
+                break;
+            }
+            numByteOrig += blockLens[numBlocks];
+            numBlocks++;
+        }
+        stats.readSeconds += secondsSince(phase);
+
+        //the header is written once the first window shows whether the
+        //source is a single block, which needs no trailer
+        if (index.empty()) {
+            singleBlock = !more && numBlocks == 1;
+            bytes.clear();
+            writeFileHeader(bytes, sourceBlockSize, singleBlock);
+            dest.write(bytes.data(), bytes.size());
+        }
+
+        //plan every block, let each reuse the code lengths of the block
+        //before it when that is smaller, then write them all
+        pool.run(numBlocks, [&](size_t i) {
+            encoders[i].planBlock(blocks[i], blockLens[i]);
+        });
+        for (size_t i = 0; i < numBlocks; i++) {
+            block_index entry; //index entry of this block, the offset is
+            //filled in once the blocks before it are written
+            entry.tableBlock = index.size();
+            if (!index.empty() && encoders[i].reuseLengths(prevLengths)) {
+                entry.tableBlock = index.back().tableBlock;
+            }
+            memcpy(prevLengths, encoders[i].codeLengths(), sizeof(prevLengths));
+            index.push_back(entry);
+        }
+        pool.run(numBlocks, [&](size_t i) {
+            encoded[i].clear();
+            encoders[i].writeBlock(blocks[i], blockLens[i], encoded[i]);
+        });
+
+        phase = chrono::steady_clock::now();
+        for (size_t i = 0; i < numBlocks; i++) {
+            index[index.size() - numBlocks + i].offset = numByteComp;
+            dest.write(encoded[i].data(), encoded[i].size());
+            numByteComp += encoded[i].size();
+        }
+        stats.flushSeconds += secondsSince(phase);
+    }
+
+    //a zero block length ends the blocks, then the seek index and
+    //the number of blocks
+    if (!singleBlock) {
+        bytes.clear();
+        writeFileTrailer(bytes, index);
+        dest.write(bytes.data(), bytes.size());
+        numByteComp += bytes.size();
+    }
+
+    //close the binary file
+    phase = chrono::steady_clock::now();
+    if (!dest.close()) {
+        msg << "Could not write " << oFileName << endl;
+        return false;
+    }
+    stats.flushSeconds += secondsSince(phase);
+    stats.bytesIn += numByteOrig;
+
+    //if our compressed file is bigger than our original, don't keep it,
+    //standard output has already been sent on
+    if (numByteComp > numByteOrig && oFileName != "-") {
+        remove(oFileName.c_str());
+        msg << iFileName << ": File will not compress" << endl;
+        return false;
+    }
+    stats.bytesOut += numByteComp;
+    return true;
+}
+
+/*
+ * description: lists the files of a batch, either every regular file of a
+ *              directory (in name order) or every line of a manifest file
+ * return: true if the directory or manifest could be read, false otherwise
+ * precondition: none
+ * postcondition: sources holds the path of every file of the batch
+ *
+*/
+
+static bool listSources(const string& name, vector<string>& sources) {
+    struct stat info; //type of name
+
+    if (stat(name.c_str(), &info) != 0) {
+        return false;
+    }
+    if (S_ISDIR(info.st_mode)) {
+        DIR* dir = opendir(name.c_str()); //the directory being listed
+        if (dir == NULL) {
+            return false;
+        }
+        for (struct dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+            string path = name + "/" + entry->d_name; //path of the entry
+            if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+                sources.push_back(path);
+            }
+        }
+        closedir(dir);
+        sort(sources.begin(), sources.end());
+        return true;
+    }
+
+    ifstream manifest(name.c_str()); //one source path per line
+    string line; //the current line
+    if (!manifest) {
+        return false;
+    }
+    while (getline(manifest, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        if (!line.empty()) {
+            sources.push_back(line);
+        }
+    }
+    return true;
+}
+
+/*
+ * description: compresses every file of a manifest or directory into
+ *              destDir, each to its own name followed by ".huf". A file
+ *              whose name was already taken by an earlier one of the batch
+ *              is reported and left out rather than overwriting it. Files of
+ *              more than batchLargeBlocks blocks are compressed one at a
+ *              time with their blocks split across the threads. Smaller
+ *              files are grouped into runs of about a block of bytes, and
+ *              each thread takes the next group until none are left, with
+ *              one encoder and set of buffers per thread reused for every
+ *              file it compresses. The total throughput is printed at the
+ *              end.
+ * return: void (N/A)
+ * precondition: window and numThreads match pool, table is NULL to build
+ *               the code of each block
+ * postcondition: every file that compresses is written to destDir
+ *
+*/
+
+static void compressBatch(const string& listName, const string& destDir, thread_pool& pool,
+                          int numThreads, size_t window, int numStreams, bool contextModel,
+                          const shared_table* table, size_t sourceBlockSize, bool showStats,
+                          ostream& msg) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now(); //start of the batch
+    vector<string> sources; //every file of the batch
+    vector<size_t> small; //index in sources of each file that is grouped
+    vector<size_t> groups; //index in small of the first file of each group
+    uint64_t groupBytes = 0; //bytes in the last group
+    huff_stats stats; //phases and metrics of the whole batch
+    vector<huff_stats> slotStats(window); //stats of each encoder slot
+    atomic<size_t> numKept(0); //number of compressed files written
+    mutex msgLock; //keeps messages of different threads apart
+    map<string, size_t> destOwners; //source given each compressed file name
+
+    if (!listSources(listName, sources)) {
+        msg << "Could not open " << listName << endl;
+        return;
+    }
+    mkdir(destDir.c_str(), 0755);
+
+    //name of the compressed file of source i
+    auto destName = [&](size_t i) {
+        size_t slash = sources[i].find_last_of('/'); //end of the directory part
+        return destDir + "/" + sources[i].substr(slash == string::npos ? 0 : slash + 1) + ".huf";
+    };
+
+    //large files go through the window of blocks one by one
+    file_compressor compressor(pool, window, numStreams, contextModel, table, sourceBlockSize,
+                               showStats ? &slotStats : NULL); //compresses large files
+    for (size_t i = 0; i < sources.size(); i++) {
+        //sources in different directories can share a name, only the
+        //first of them is compressed
+        auto owner = destOwners.insert(make_pair(destName(i), i)); //source given the name
+        if (!owner.second) {
+            msg << sources[i] << ": Same destination as " << sources[owner.first->second]
+                << endl;
+            continue;
+        }
+
+        struct stat info; //size of the file
+        bool regular = stat(sources[i].c_str(), &info) == 0 && S_ISREG(info.st_mode); //true
+        //for a regular file, false if it is missing or something else
+        if (regular && (uint64_t)info.st_size > batchLargeBlocks * sourceBlockSize) {
+            numKept += compressor.compress(sources[i], destName(i), msg, stats);
+        }
+        else {
+            //start a new group once the last one holds a block of bytes
+            if (groups.empty() || groupBytes >= sourceBlockSize) {
+                groups.push_back(small.size());
+                groupBytes = 0;
+            }
+            groupBytes += regular ? info.st_size : 0;
+            small.push_back(i);
+        }
+    }
+    groups.push_back(small.size());
+
+    //one slot per thread, each takes the next group until none are left
+    vector<huff_encoder> encoders(numThreads); //encoder of each slot
+    vector<huff_stats> groupStats(numThreads); //sizes and phases of each slot
+    atomic<size_t> nextGroup(0); //next group to compress
+    pool.run(numThreads, [&](size_t slot) {
+        vector<char> sourceBuf; //holds the file if it can't be mapped
+        vector<unsigned char> compressed; //the compressed file
+        encoders[slot].numStreams = numStreams;
+        encoders[slot].contextModel = contextModel;
+        encoders[slot].sharedTable = table;
+        if (showStats) {
+            encoders[slot].stats = &groupStats[slot];
+        }
+
+        for (size_t g = nextGroup++; g + 1 < groups.size(); g = nextGroup++) {
+            for (size_t k = groups[g]; k < groups[g + 1]; k++) {
+                size_t i = small[k]; //index of the file in sources
+                uint64_t size = 0; //number of bytes in the file
+                input_file source; //the file being compressed
+                output_file dest; //the binary file
+                string message; //problem to report, empty if none
+
+                chrono::steady_clock::time_point phase = chrono::steady_clock::now(); //start
+                //of the read
+                if (!source.open(sources[i])) {
+                    message = "Could not open " + sources[i];
+                }
+                else {
+                    const unsigned char* data = source.all(sourceBuf, size); //the file
+                    groupStats[slot].readSeconds += secondsSince(phase);
+                    encoders[slot].compress((const char*)data, size, compressed, sourceBlockSize);
+                    groupStats[slot].bytesIn += size;
+
+                    phase = chrono::steady_clock::now();
+                    if (compressed.size() > size) {
+                        message = sources[i] + ": File will not compress";
+                    }
+                    else if (!dest.open(destName(i))) {
+                        message = "Could not open " + destName(i);
+                    }
+                    else {
+                        dest.write(compressed.data(), compressed.size());
+                        if (!dest.close()) {
+                            message = "Could not write " + destName(i);
+                        }
+                        else {
+                            groupStats[slot].bytesOut += compressed.size();
+                            numKept++;
+                        }
+                    }
+                    groupStats[slot].flushSeconds += secondsSince(phase);
+                }
+
+                if (!message.empty()) {
+                    lock_guard<mutex> guard(msgLock);
+                    msg << message << endl;
+                }
+            }
+        }
+    });
+
+    for (int i = 0; i < numThreads; i++) {
+        stats.add(groupStats[i]);
+    }
+    double seconds = secondsSince(start); //wall time of the batch
+    msg << "Compressed " << numKept << " of " << sources.size() << " files, " << stats.bytesIn
+        << " bytes to " << stats.bytesOut << " bytes in " << seconds << " s ("
+        << stats.bytesIn / max(seconds, 1e-9) / 1e6 << " MB/s)" << endl;
+    if (showStats) {
+        reportStats(stats, slotStats, start);
+    }
+}
 
-using namespace std;
+/*
+ * description: trains a shared code table on a corpus, either one file or
+ *              every regular file of a directory, and writes it to
+ *              tableName. Files compressed with the table only store its id,
+ *              so inputs too small to pay for their own code lengths still
+ *              compress.
+ * return: true if the table was written, false otherwise
+ * precondition: none
+ * postcondition: problems and the table's id are reported on msg
+ *
+*/
 
-//node class used to create nodes for the Huffman tree
-struct node {
-    int count; //variable for the char frequency
-    char c; //the char of the node
-    node *left, *right; //the left and right children of the node
-    
-    /*
-     * description: default constructor for the node
-     * return: none
-     * precondition: none, lptr and rptr are null by default
-     * postcondition: creates node with the specificed lptr and
-     *                rptr (or null by default) that has count
-     *                0 and stores the '\0' character
-     *
-    */
-    node(node *lptr = nullptr, node* rptr = nullptr) {
-        count = 0;
-        c = '\0';
-        left = lptr;
-        right = rptr;
-        
-        //if given left and right child, make the count equal to their sum
-        if (left && right) {
-            count = left->count + right->count;
+static bool trainTable(const string& corpusName, const string& tableName, ostream& msg) {
+    struct stat info; //type of the corpus
+    vector<string> sources; //every file of the corpus
+    vector<char> sourceBuf; //holds a file if it can't be mapped
+    uint64_t freq[256] = {0}; //character counts of the whole corpus
+    uint64_t total = 0; //number of bytes in the corpus
+    shared_table table; //the trained table
+    vector<unsigned char> bytes; //the table file
+    output_file dest; //the table file
+
+    if (corpusName != "-" && stat(corpusName.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+        listSources(corpusName, sources);
+    }
+    else {
+        sources.push_back(corpusName);
+    }
+    for (size_t i = 0; i < sources.size(); i++) {
+        input_file source; //the file being counted
+        uint64_t size = 0; //number of bytes in the file
+        if (!source.open(sources[i])) {
+            msg << "Could not open " << sources[i] << endl;
+            return false;
         }
+        const unsigned char* data = source.all(sourceBuf, size); //the file
+        countBytes(data, size, freq);
+        total += size;
     }
-};
 
-//class used to compare two nodes
-class cmp_node {
-public:
-    /*
-     * description: this function compares two nodeds, returns true
-     *              if first node has higher frequency than the second
-     * return: true if node a has the higher count, false otherwise
-     * precondition: node* a and b exist and are valid
-     * postcondition: returns true if a has a higher count data member,
-     *                false otherwise
-     *
-    */
-    bool operator()(node *a, node *b) {
-        return a->count > b->count;
+    table.train(freq);
+    writeTable(bytes, table);
+    if (!dest.open(tableName)) {
+        msg << "Could not open " << tableName << endl;
+        return false;
     }
-};
+    dest.write(bytes.data(), bytes.size());
+    if (!dest.close()) {
+        msg << "Could not write " << tableName << endl;
+        return false;
+    }
+    msg << "Trained code table " << hex << table.id << dec << " on " << total << " bytes of "
+        << sources.size() << " files" << endl;
+    return true;
+}
 
 /*
- * description: converts a string that represents an 8 bit
- *              binary number into an actual byte (unsigned char).
- * return: unsigned char
- * precondition: codeString has size 8 and represents an 8 bit binary
-                 number
- * postcondition: returns a byte (unsigned char) that was represented
- *                by the string.
+ * description: reads a shared code table written by trainTable
+ * return: true if the table was read, false otherwise
+ * precondition: none
+ * postcondition: problems are reported on msg
  *
 */
 
-unsigned char convertToByte (string codeString) {
-    unsigned char number = 0; //initalizing byte
+static bool loadTable(const string& tableName, shared_table& table, ostream& msg) {
+    input_file source; //the table file
+    vector<char> sourceBuf; //holds the table if it can't be mapped
+    uint64_t size = 0; //number of bytes in the table file
 
-    //if there is a 1 in the string, we shift a 1
-    //onto the byte. Otherwise, leave it be.
-    for(int i=7; i>=0; i--)
-    {
-        unsigned char temp = 1;
-        if (codeString[i] == '1')
-        {
-            temp <<= (7-i);
-            number |= temp;
-        }
+    if (!source.open(tableName)) {
+        msg << "Could not open " << tableName << endl;
+        return false;
     }
-    
-    return number;
+    const unsigned char* data = source.all(sourceBuf, size); //the table file
+    if (!readTable(data, size, table)) {
+        msg << tableName << " is not a code table" << endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * description: reports why a block could not be decoded if it was written
+ *              with a shared table that wasn't given or doesn't match
+ * return: true if a missing table was reported, false otherwise
+ * precondition: block holds the size bytes of a block after its length
+ *               field, table is NULL if no table was given
+ * postcondition: the id of the needed table is reported on msg
+ *
+*/
+
+static bool reportMissingTable(const unsigned char* block, size_t size,
+                               const shared_table* table, ostream& msg) {
+    uint64_t id; //id of the table the block needs
+
+    if (!blockTableId(block, size, id) || (table != NULL && table->id == id)) {
+        return false;
+    }
+    msg << "Input file needs code table " << hex << id << dec << ", given with -table" << endl;
+    return true;
+}
+
+/*
+ * description: estimates how well a file would compress from a sample of
+ *              it, without coding or writing anything
+ * return: true if the file could be read, false otherwise
+ * precondition: sourceBlockSize is the block size -huff would use
+ * postcondition: the estimated compressed size is reported on msg
+ *
+*/
+
+static bool estimateFile(const string& iFileName, size_t sourceBlockSize, ostream& msg) {
+    input_file source; //the source file, mapped when possible
+    vector<char> sourceBuf; //holds the source if it can't be mapped
+    uint64_t size = 0; //number of bytes in the source
+    char line[128]; //the formatted estimate
+
+    if (!source.open(iFileName)) {
+        msg << "Could not open " << iFileName << endl;
+        return false;
+    }
+    const unsigned char* data = source.all(sourceBuf, size); //the source
+    uint64_t estimate = estimateSize(data, size, sourceBlockSize); //estimated compressed size
+    snprintf(line, sizeof(line), "about %llu of %llu bytes (%.1f%%), ",
+             (unsigned long long)estimate, (unsigned long long)size,
+             size ? 100.0 * estimate / size : 100.0);
+    msg << iFileName << " would compress to " << line
+        << (estimate < size ? "it will compress" : "it will not compress") << endl;
+    return true;
 }
 
+static atomic<bool> stopServing(false); //set once -serve should stop, read by
+//every worker, so it is atomic rather than only safe for the signalled thread
+
 /*
- * description: uses Huffman tree to create encodings for each character
+ * description: signal handler that asks -serve to stop
  * return: void (N/A)
- * precondition: root is the root node of the huffman tree, str is valid,
- *               myMap is valid
- * postcondition: no return, but encodeTable will be populated with strings
-                  of the encodings
+ * precondition: installed for SIGINT and SIGTERM
+ * postcondition: stopServing is set
  *
 */
 
-void encodeData(node* root, string str, map<char, string>& myMap) {
-    
-    //if not null, insert the path we used to get to the root
-    if (root == NULL) {
-        return;
+static void requestStop(int) {
+    stopServing = true;
+}
+
+/*
+ * description: finds the latency histogram bucket of a request, buckets
+ *              split each power of two nanoseconds into 8 equal parts
+ * return: the bucket, 0 to latencyBuckets - 1
+ * precondition: none
+ * postcondition: none
+ *
+*/
+
+static int latencyBucket(uint64_t nanos) {
+    if (nanos < 8) {
+        return nanos;
+    }
+    int top = 63 - __builtin_clzll(nanos); //position of the highest set bit
+    return (top - 2) * 8 + ((nanos >> (top - 3)) & 7);
+}
+
+/*
+ * description: finds the smallest latency that falls in a bucket
+ * return: nanoseconds at the start of the bucket
+ * precondition: bucket is 0 to latencyBuckets - 1
+ * postcondition: none
+ *
+*/
+
+static uint64_t bucketStart(int bucket) {
+    if (bucket < 8) {
+        return bucket;
     }
-    if (root->c != '\0') {
-        myMap.insert(pair<char, string>(root->c, str));
+    return (uint64_t)(8 + bucket % 8) << (bucket / 8 - 1);
+}
+
+/*
+ * description: waits until a socket can be read from (or is closed) or
+ *              written to, waking up now and then to see if the server is
+ *              stopping
+ * return: true if the socket is ready, false if the server is stopping or
+ *         limitMillis passed first
+ * precondition: fd is an open socket, events is POLLIN or POLLOUT,
+ *               limitMillis is -1 to wait for as long as the server runs
+ * postcondition: none
+ *
+*/
+
+static bool waitReady(int fd, short events, int limitMillis) {
+    pollfd ready = {fd, events, 0}; //the socket to wait on
+    for (int waited = 0; !stopServing && (limitMillis < 0 || waited < limitMillis);
+         waited += stopCheckMillis) {
+        if (poll(&ready, 1, stopCheckMillis) > 0) {
+            return true;
+        }
     }
-    
-    //use recursion to traverse the tree and add to encode string
-    encodeData(root->left, str + "0", myMap);
-    encodeData(root->right, str + "1", myMap);
+    return false;
+}
+
+/*
+ * description: moves all of a request or reply through a non-blocking
+ *              connection, waiting for it between calls so a client that
+ *              stalls can't hold the worker past stallMillis or a stop
+ * return: true if every byte was moved, false if the connection closed,
+ *         failed or stalled, or the server is stopping
+ * precondition: fd is an open non-blocking connection
+ * postcondition: the bytes are read into data or written from it
+ *
+*/
+
+static bool moveServed(int fd, bool reading, char* data, size_t len) {
+    size_t done = 0; //bytes moved so far
+    while (done < len) {
+        if (!waitReady(fd, reading ? POLLIN : POLLOUT, stallMillis)) {
+            return false;
+        }
+        ssize_t n = reading ? read(fd, data + done, len - done)
+                            : ::write(fd, data + done, len - done); //bytes from this call
+        if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        done += n;
+    }
+    return true;
+}
+
+/*
+ * description: sends a -serve reply: its status (0 if the request worked, 1
+ *              if not), the nanoseconds the server spent on it, the length
+ *              of the payload (8 bytes each) and the payload, which is the
+ *              result or an error message
+ * return: true if the whole reply was sent, false otherwise
+ * precondition: fd is an open non-blocking connection, payload holds len bytes
+ * postcondition: the reply is written to fd
+ *
+*/
+
+static bool sendReply(int fd, unsigned char status, uint64_t nanos, const void* payload,
+                      uint64_t len) {
+    char header[replyHeaderSize]; //status, nanoseconds and length
+    header[0] = status;
+    memcpy(header + 1, &nanos, sizeof(nanos));
+    memcpy(header + 9, &len, sizeof(len));
+
+    //both parts go in one call, a short write sends the rest piece by piece
+    iovec parts[2] = {{header, replyHeaderSize}, {(void*)payload, len}}; //header and payload
+    ssize_t sent = writev(fd, parts, 2); //bytes written by writev
+    if (sent < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+    }
+    sent = max(sent, (ssize_t)0);
+    if ((size_t)sent < replyHeaderSize &&
+        !moveServed(fd, false, header + sent, replyHeaderSize - sent)) {
+        return false;
+    }
+    size_t done = max((size_t)sent, replyHeaderSize) - replyHeaderSize; //payload bytes sent
+    return moveServed(fd, false, (char*)payload + done, len - done);
+}
+
+/*
+ * description: reads one request from a connection, compresses or
+ *              decompresses its payload with the slot's encoder or decoder
+ *              and sends the reply. A request is its operation ('c' to
+ *              compress, 'd' to decompress, 1 byte), the length of its
+ *              payload (8 bytes) and the payload. The compressed form is
+ *              the file format -huff writes.
+ * return: true if the connection can carry another request, false if it
+ *         was closed or can't be trusted to be in step
+ * precondition: fd is an open non-blocking connection a request has
+ *               started to arrive on, the slot's encoder and decoder are
+ *               set up
+ * postcondition: the reply is sent, the slot's counters and latency
+ *                histogram include the request
+ *
+*/
+
+static bool serveRequest(int fd, server_slot& slot, size_t sourceBlockSize, bool showStats,
+                         mutex& msgLock) {
+    char header[requestHeaderSize]; //operation and payload length
+    uint64_t len; //number of bytes in the payload
+    const void* reply; //payload of the reply
+    uint64_t replyLen; //number of bytes in the reply
+    unsigned char status = 0; //0 if the request worked, 1 if not
+    string error; //message sent back when the request failed
+
+    //once a request starts it has to keep coming
+    if (!moveServed(fd, true, header, requestHeaderSize)) {
+        return false;
+    }
+    chrono::steady_clock::time_point start = chrono::steady_clock::now(); //arrival of the request
+    memcpy(&len, header + 1, sizeof(len));
+    if (len > maxRequestSize) {
+        error = "Request too large";
+        sendReply(fd, 1, 0, error.data(), error.size());
+        return false;
+    }
+    slot.request.resize(len);
+    if (!moveServed(fd, true, slot.request.data(), len)) {
+        return false;
+    }
+
+    if (header[0] == 'c') {
+        slot.encoder.compress(slot.request.data(), len, slot.compressed, sourceBlockSize);
+        reply = slot.compressed.data();
+        replyLen = slot.compressed.size();
+    }
+    else if (header[0] == 'd' && slot.decoder.decompress((const unsigned char*)slot.request.data(),
+                                                         len, slot.decoded, maxRequestSize)) {
+        reply = slot.decoded.data();
+        replyLen = slot.decoded.size();
+    }
+    else {
+        error = header[0] == 'd' ? "Input was not Huffman encoded or decodes to too much"
+                                 : "Unknown request";
+        status = 1;
+        reply = error.data();
+        replyLen = error.size();
+    }
+
+    uint64_t nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() -
+                                                                start).count(); //time spent
+    //on the request
+    slot.requests++;
+    slot.bytesIn += len;
+    slot.bytesOut += replyLen;
+    slot.latency[latencyBucket(nanos)]++;
+    slot.maxLatency = max(slot.maxLatency, nanos);
+    if (showStats) {
+        char line[160]; //per-request stats line
+        snprintf(line, sizeof(line), "stats request=%c status=%d bytes_in=%llu bytes_out=%llu "
+                 "micros=%.1f\n", header[0], status, (unsigned long long)len,
+                 (unsigned long long)replyLen, nanos / 1e3);
+        lock_guard<mutex> guard(msgLock);
+        cerr << line;
+    }
+    return sendReply(fd, status, nanos, reply, replyLen);
 }
 
 /*
- * description: uses Huffman tree to create decodings for each character
+ * description: accepts connections and polls every one that is waiting for
+ *              its next request, until the server stops. A connection whose
+ *              request starts to arrive is handed to the workers, which
+ *              give it back once they have answered it. One that sends no
+ *              request for idleMillis is closed, so idle clients can't pile
+ *              up.
  * return: void (N/A)
- * precondition: root is the root node of the huffman tree, str is valid,
- *               myMap is valid
- * postcondition: no return, but dencodeTable will be populated with strings
-                  of the encodings
+ * precondition: listenFd is a listening non-blocking socket, the queue's
+ *               pipe is open and non-blocking
+ * postcondition: the queue is closing and every connection is closed
  *
 */
 
-void dencodeData(node* root, string str, map<string, char>& myMap) {
+static void pollConnections(int listenFd, server_queue& queue) {
+    vector<pollfd> fds; //the listening socket, the wake pipe, then each idle connection
+    vector<chrono::steady_clock::time_point> lastUsed; //when each connection last
+    //finished a request or was accepted
+    char drain[64]; //bytes read off the wake pipe
 
-    //if not null, insert the path we used to get to the root
-    if (root == NULL) {
-        return;
+    fds.push_back({listenFd, POLLIN, 0});
+    fds.push_back({queue.wakeFds[0], POLLIN, 0});
+    lastUsed.resize(2);
+    while (!stopServing) {
+        if (poll(fds.data(), fds.size(), stopCheckMillis) < 0 && errno != EINTR) {
+            break;
+        }
+        chrono::steady_clock::time_point now = chrono::steady_clock::now(); //time of the poll
+
+        //connections the workers are done with are polled again
+        if (fds[1].revents != 0) {
+            while (read(queue.wakeFds[0], drain, sizeof(drain)) > 0) {
+            }
+            lock_guard<mutex> guard(queue.lock);
+            for (size_t k = 0; k < queue.served.size(); k++) {
+                fds.push_back({queue.served[k], POLLIN, 0});
+                lastUsed.push_back(now);
+            }
+            queue.served.clear();
+        }
+        if (fds[0].revents != 0) {
+            for (int fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC); fd >= 0;
+                 fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) {
+                fds.push_back({fd, POLLIN, 0});
+                lastUsed.push_back(now);
+            }
+        }
+
+        //hand on the connections a request (or a close) arrived on, drop
+        //the ones idle for too long
+        for (size_t k = 2; k < fds.size();) {
+            bool ready = fds[k].revents != 0; //true if the connection can be read
+            if (ready || now - lastUsed[k] >= chrono::milliseconds(idleMillis)) {
+                if (ready) {
+                    lock_guard<mutex> guard(queue.lock);
+                    queue.ready.push_back(fds[k].fd);
+                    queue.changed.notify_one();
+                }
+                else {
+                    close(fds[k].fd);
+                }
+                fds[k] = fds.back();
+                lastUsed[k] = lastUsed.back();
+                fds.pop_back();
+                lastUsed.pop_back();
+            }
+            else {
+                k++;
+            }
+        }
     }
-    if (root->c != '\0') {
-        myMap.insert(pair<string, char>(str, root->c));
+
+    //workers close the connections they are serving once they see closing
+    lock_guard<mutex> guard(queue.lock);
+    queue.closing = true;
+    for (size_t k = 2; k < fds.size(); k++) {
+        close(fds[k].fd);
     }
-    
-    //use recursion to traverse the tree and add to dencode string
-    dencodeData(root->left, str + "0", myMap);
-    dencodeData(root->right, str + "1", myMap);
+    for (size_t k = 0; k < queue.ready.size(); k++) {
+        close(queue.ready[k]);
+    }
+    for (size_t k = 0; k < queue.served.size(); k++) {
+        close(queue.served[k]);
+    }
+    queue.ready.clear();
+    queue.served.clear();
+    queue.changed.notify_all();
 }
 
 /*
- * description: converts a byte to a string that represents that byte
- *                       in binary form.
- * return: returns the string that represents the byte
- * precondition: theByte is a valid byte
- * postcondition: returns string that represents the byte.
+ * description: serves compress and decompress requests on a Unix domain
+ *              socket until SIGINT or SIGTERM. A thread of its own polls
+ *              the open connections, and each request that arrives goes to
+ *              the next free one of numThreads workers, so a client that
+ *              keeps a connection open without sending holds none of them.
+ *              Workers keep their encoder, decoder and buffers (and with a
+ *              shared table, its decode table) from one request to the
+ *              next. A connection that stalls in the middle of a request
+ *              is dropped, one that stays idle for idleMillis is closed.
+ *              The latency of every request is sent back with it, and a
+ *              summary is printed when the server stops.
+ * return: true if the socket could be served, false otherwise
+ * precondition: pool has numThreads threads
+ * postcondition: problems and the summary are reported on msg, the socket
+ *                file is removed
  *
 */
 
-string byteToString(unsigned char theByte) {
-    string theString;
-    int output[8];
-    
-    //populate output with the bits from the char
-    for (int i = 0; i < 8; ++i) {
-      output[i] = (theByte >> i) & 1;
+static bool serveRequests(const string& socketName, thread_pool& pool, int numThreads,
+                          int numStreams, bool contextModel, const shared_table* table,
+                          size_t sourceBlockSize, bool showStats, ostream& msg) {
+    sockaddr_un addr; //address of the socket
+    struct stat info; //type of a file already at the socket's path
+    vector<server_slot> slots(numThreads); //state of each worker
+    server_queue queue; //connections passed between the poller and the workers
+    mutex msgLock; //keeps stats lines of different workers apart
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketName.size() >= sizeof(addr.sun_path)) {
+        msg << "Socket path too long: " << socketName << endl;
+        return false;
     }
-    //add it to the string
-    for (int i = 7; i >= 0; i--) {
-        theString = theString + to_string(output[i]);
+    memcpy(addr.sun_path, socketName.c_str(), socketName.size());
+
+    //a socket left behind by a server that is gone is replaced, one that
+    //still answers is not
+    int listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0); //the listening socket
+    if (listenFd >= 0 && lstat(socketName.c_str(), &info) == 0) {
+        if (!S_ISSOCK(info.st_mode) || connect(listenFd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+            msg << "Could not listen on " << socketName << ", it is in use" << endl;
+            close(listenFd);
+            return false;
+        }
+        close(listenFd);
+        unlink(socketName.c_str());
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
     }
-    
-    return theString;
+    if (listenFd < 0 || ::bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0) {
+        msg << "Could not listen on " << socketName << endl;
+        if (listenFd >= 0) {
+            close(listenFd);
+        }
+        return false;
+    }
+    //the poller accepts every waiting connection, then goes back to polling
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    if (pipe2(queue.wakeFds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        msg << "Could not listen on " << socketName << endl;
+        close(listenFd);
+        return false;
+    }
+    queue.closing = false;
+
+    struct sigaction stop; //handler that ends the server
+    memset(&stop, 0, sizeof(stop));
+    stop.sa_handler = requestStop;
+    sigaction(SIGINT, &stop, NULL);
+    sigaction(SIGTERM, &stop, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    msg << "Serving " << socketName << " with " << numThreads << " workers" << endl;
+
+    thread poller(pollConnections, listenFd, ref(queue)); //polls the connections
+    pool.run(numThreads, [&](size_t i) {
+        server_slot& slot = slots[i]; //state of this worker
+        slot.encoder.numStreams = numStreams;
+        slot.encoder.contextModel = contextModel;
+        slot.encoder.sharedTable = table;
+        slot.decoder.sharedTable = table;
+        slot.requests = slot.bytesIn = slot.bytesOut = slot.maxLatency = 0;
+        memset(slot.latency, 0, sizeof(slot.latency));
+
+        //buffers start at a block's size so small requests never grow them
+        slot.request.reserve(sourceBlockSize);
+        slot.compressed.reserve(sourceBlockSize);
+        slot.decoded.reserve(sourceBlockSize);
+
+        //serve one request at a time, then give the connection back to be
+        //polled for the next
+        unique_lock<mutex> guard(queue.lock);
+        for (;;) {
+            queue.changed.wait(guard, [&] { return queue.closing || !queue.ready.empty(); });
+            if (queue.closing) {
+                return;
+            }
+            int fd = queue.ready.front(); //connection a request arrived on
+            queue.ready.pop_front();
+            guard.unlock();
+            bool keep = serveRequest(fd, slot, sourceBlockSize, showStats, msgLock); //true
+            //if the connection can carry another request
+            guard.lock();
+            if (!keep || queue.closing) {
+                close(fd);
+                continue;
+            }
+            char wake = 0; //byte that wakes the poller, a full pipe wakes it anyway
+            queue.served.push_back(fd);
+            while (::write(queue.wakeFds[1], &wake, 1) < 0 && errno == EINTR) {
+            }
+        }
+    });
+    poller.join();
+    close(queue.wakeFds[0]);
+    close(queue.wakeFds[1]);
+    close(listenFd);
+    unlink(socketName.c_str());
+
+    //add up the workers and find the percentiles from the histogram
+    uint64_t latency[latencyBuckets] = {0}; //requests in each latency bucket
+    uint64_t requests = 0; //requests served by every worker
+    uint64_t bytesIn = 0; //payload bytes received by every worker
+    uint64_t bytesOut = 0; //payload bytes sent back by every worker
+    uint64_t maxLatency = 0; //slowest request of any worker
+    for (int i = 0; i < numThreads; i++) {
+        requests += slots[i].requests;
+        bytesIn += slots[i].bytesIn;
+        bytesOut += slots[i].bytesOut;
+        maxLatency = max(maxLatency, slots[i].maxLatency);
+        for (int b = 0; b < latencyBuckets; b++) {
+            latency[b] += slots[i].latency[b];
+        }
+    }
+    const double quantiles[2] = {0.5, 0.99}; //reported percentiles
+    double micros[2] = {0, 0}; //upper end of the bucket holding each percentile
+    for (int q = 0; q < 2; q++) {
+        uint64_t seen = 0; //requests in the buckets so far
+        for (int b = 0; b < latencyBuckets && requests != 0; b++) {
+            seen += latency[b];
+            if (seen >= quantiles[q] * requests) {
+                micros[q] = min(bucketStart(b + 1), maxLatency) / 1e3;
+                break;
+            }
+        }
+    }
+    msg << "Served " << requests << " requests, " << bytesIn << " bytes in and " << bytesOut
+        << " bytes out, latency p50 " << micros[0] << " us, p99 " << micros[1] << " us, max "
+        << maxLatency / 1e3 << " us" << endl;
+    return true;
 }
 
 /*
@@ -204,353 +2004,342 @@ string byteToString(unsigned char theByte) {
 
 
 int main(int argc, char** argv) {
-    priority_queue<node*, vector<node*>, cmp_node> n; //priority
-    //queue used to create huffman tree
-    node* p; //temporary node p used to help construct huffman tree
-    char ch; //temporary char to read in from file
-    map<char, int> charMap; //map used to store chars with their
-    map<string, char> dencodeTable; //map used to hold encoding with the encoding string
-                                    //as the key
-    //frequency
-    ifstream myFile; //input file stream used to read from text
-    //file
-    fstream outputFile; //output file stream used to write to binary
-    //file
-    ofstream finalFile; //output file stream to write to textfile
-    //while unhuffing
-    int magicNum = 312341; //arbitrary random number used as the
-    //magic number for our huffman encoding
-    char eofChar = 13; //eof character to signify when we are done
-    //reading from the binary file
-    unsigned char myByte = 0; //temporary byte used to write bytes
-    //to the binary file
+    int numThreads = 1; //number of threads used for blocks
+    int numStreams = defaultStreams; //interleaved bitstreams in each block
+    size_t sourceBlockSize = blockSize; //number of source bytes in each block
+    uint64_t extractOffset = 0; //first source byte given by -extract
+    uint64_t extractLength = 0; //number of source bytes given by -extract
+    int firstOption = 4; //position of the first option in argv
+    bool showStats = false; //true to print stats once done
+    bool contextModel = false; //true to try order-1 models on each block
+    string tableName; //shared code table given by -table, empty if none
+    shared_table table; //the shared code table
+    const shared_table* sharedTable = NULL; //the shared code table, NULL if none
+    chrono::steady_clock::time_point start = chrono::steady_clock::now(); //start of the run
+    bool noDestination = argc >= 3 && (string(argv[1]) == "-estimate" ||
+                                       string(argv[1]) == "-serve"); //true for the commands
+    //that take only a source
+
+    if (argc < 4 && !noDestination) {
+        cout << "Usage: -huff <source> <destination> [-j threads] [-streams n] [--stats]" << endl;
+        cout << "       -unhuff <source> <destination> [-j threads] [--stats]" << endl;
+        cout << "       -extract <source> <destination> <offset> <length>" << endl;
+        cout << "       -batch <manifest or directory> <destination directory> [-j threads]" << endl;
+        cout << "       -train <corpus file or directory> <table>" << endl;
+        cout << "       -estimate <source> [-b block size]" << endl;
+        cout << "       -serve <socket> [-j workers] [-b block size] [-streams n] [-context]"
+             << " [-table table] [--stats]" << endl;
+        cout << "       -huff and -batch also take [-b block size] [-streams n] [-context] [--stats]"
+             << endl;
+        cout << "       -huff, -unhuff, -extract and -batch take [-table table]" << endl;
+        cout << "       a source or destination of - uses standard input or output" << endl;
+        return 0;
+    }
     string command = argv[1]; //first command line argument
     string iFileName = argv[2]; //second command line argument
-    string oFileName = argv[3]; //third command line argument
-    map<char, int>::iterator itr; //iterator used to loop through char map;
+    string oFileName = noDestination ? "" : argv[3]; //third command line argument
+    ostream& msg = (oFileName == "-") ? cerr : cout; //where messages go, kept
+    //off standard output when it carries the destination
+
+    //-extract takes the range before the options
+    if (command == "-extract") {
+        if (argc < 6) {
+            cout << "Usage: -extract <source> <destination> <offset> <length>" << endl;
+            return 0;
+        }
+        extractOffset = strtoull(argv[4], NULL, 10);
+        extractLength = strtoull(argv[5], NULL, 10);
+        firstOption = 6;
+    }
+    if (noDestination) {
+        firstOption = 3;
+    }
+
+    //options after the file names, -j 0 uses every core
+    for (int i = firstOption; i < argc; i++) {
+        if (string(argv[i]) == "-j" && i + 1 < argc) {
+            numThreads = atoi(argv[++i]);
+        }
+        else if (string(argv[i]) == "-streams" && i + 1 < argc) {
+            numStreams = max(1, min(atoi(argv[++i]), maxStreams));
+        }
+        else if (string(argv[i]) == "-b" && i + 1 < argc) {
+            sourceBlockSize = max(minBlockSize, min((size_t)strtoull(argv[++i], NULL, 10), maxBlockSize));
+        }
+        else if (string(argv[i]) == "--stats") {
+            showStats = true;
+        }
+        else if (string(argv[i]) == "-context") {
+            contextModel = true;
+        }
+        else if (string(argv[i]) == "-table" && i + 1 < argc) {
+            tableName = argv[++i];
+        }
+    }
+    if (!tableName.empty()) {
+        if (!loadTable(tableName, table, msg)) {
+            return 0;
+        }
+        sharedTable = &table;
+    }
+    if (numThreads <= 0) {
+        numThreads = max(1u, thread::hardware_concurrency());
+    }
+    thread_pool pool(numThreads); //threads blocks are spread across
+    size_t window = 4 * numThreads; //number of blocks in memory at once
+    huff_stats stats; //phases and metrics of the whole run
+    vector<huff_stats> slotStats(window); //stats of each block slot, kept
+    //apart so threads don't share counters
+    chrono::steady_clock::time_point phase; //start of the phase being timed
 
     
     
     //if we are huffing
     if (command == "-huff") {
-        map<char, string> encodeTable; //map used to hold encodings with char as the key
-        int numByteOrig = 0; //int variable used to find number
-        //of bytes in original file
-        int numByteComp = 8; //int variable used to track number of
-        //bytes in binary file
-        //will start at 8 bytes because magic number(4) and numChar(4).
-        string encodCountString = ""; //string used to represent
-        //our encoding that we will write to binary file
-        //used to find how many bytes we will write to binary file
-        //map<char, int>::iterator itr; //iterator used to loop through char map;
-        
-        
-        myFile.open(iFileName);
-        
-        //while reading from file
-        while (myFile.get(ch)) {
-            numByteOrig++;
-            
-            //if its not in map, add it
-            if (charMap.find(ch) == charMap.end()) {
-                charMap.insert(pair<char, int>(ch, 1));
-            }
-            
-            //if its in the map, update its frequency
-            else if (charMap.find(ch) != charMap.end()) {
-                itr = charMap.find(ch);
-                (*itr).second = (*itr).second + 1;
-            }
+        file_compressor compressor(pool, window, numStreams, contextModel, sharedTable,
+                                   sourceBlockSize, showStats ? &slotStats : NULL); //compresses
+        //the file
+        if (compressor.compress(iFileName, oFileName, msg, stats) && showStats) {
+            reportStats(stats, slotStats, start);
         }
-        
-        //insert EOF character
-        charMap.insert(pair<char, int>(eofChar, 1));
-        numByteComp = numByteComp + charMap.size() * 5; //5 bytes for each
-        // char/int pair we put in encoding file
-        myFile.close();
-        
-        
-        //create all the nodes in the tree and add to priority queue
-        itr = charMap.begin();
-        while (itr != charMap.end()) {
-            p = new node();
-            p->c = itr->first;
-            p->count = itr->second;
-            n.push(p);
-            
-            itr++;
+    }
+
+    //compress every file of a manifest or directory
+    else if (command == "-batch") {
+        compressBatch(iFileName, oFileName, pool, numThreads, window, numStreams, contextModel,
+                      sharedTable, sourceBlockSize, showStats, msg);
+    }
+
+    //train a shared code table on a corpus
+    else if (command == "-train") {
+        trainTable(iFileName, oFileName, msg);
+    }
+
+    //estimate the compressed size from a sample of the source
+    else if (command == "-estimate") {
+        estimateFile(iFileName, sourceBlockSize, msg);
+    }
+
+    //serve compress and decompress requests on a Unix domain socket
+    else if (command == "-serve") {
+        serveRequests(iFileName, pool, numThreads, numStreams, contextModel, sharedTable,
+                      sourceBlockSize, showStats, msg);
+    }
+    
+    
+    
+    //UNHUFF
+    //reading decompressed file
+    else if (command == "-unhuff") {
+        input_file source; //the binary file, mapped when possible
+        output_file dest; //the destination file
+        vector<char> headerBuf; //holds the file header if it can't be mapped
+        const char* header; //the file header
+        size_t headerLen = 0; //number of bytes in the file header
+        uint64_t numByteComp = 0; //number of bytes in the binary file
+        int firstNum = 0; //variable to read the first number
+
+        if (!source.open(iFileName)) {
+            msg << "Could not open " << iFileName << endl;
+            return 0;
         }
+        phase = chrono::steady_clock::now();
+        header = source.next(fileHeaderSize, headerBuf, headerLen);
+        stats.readSeconds += secondsSince(phase);
+        numByteComp += headerLen;
         
-        
-        node *n1, *n2; //temporary nodes used to read from top of queue
-        //create huffman tree using the priority queue
-        while (n.size() > 1) {
-            n1 = n.top();
-            n.pop();
-            
-            n2 = n.top();
-            n.pop();
-            p = new node(n1, n2);
-            n.push(p);
+        //read the magic number, see if it matches
+        if (headerLen >= sizeof(firstNum)) {
+            memcpy(&firstNum, header, sizeof(firstNum));
         }
         
-        //create our encoding map
-        encodeTable.clear();
-        encodeData(p, "", encodeTable);
-        
-        //reopen file to create encoding string representation
-        myFile.open(iFileName);
-        
-        //create string and make it divisible by 8 (to represent bytes)
-        while (myFile.get(ch)) {
-            encodCountString = encodCountString + encodeTable[ch];
+        //if it doesn't match, end the program.
+        if (firstNum != legacyMagicNum && firstNum != canonMagicNum) {
+            msg << "Input file was not Huffman Endoded." << endl;
+            return 0;
         }
-        while ( (encodCountString.size() % 8) != 0) {
-            encodCountString = encodCountString + 'd';
+        if (firstNum == canonMagicNum && (headerLen <= 5 || header[4] != formatVersion ||
+                                          (header[5] & ~singleBlockFlag) != 0)) {
+            msg << "Unsupported Huffman format version." << endl;
+            return 0;
         }
-        numByteComp = numByteComp + (encodCountString.size() / 8);
-        myFile.close();
-        
-        //if our compressed file would be bigger than our original, don't compress
-        if (numByteComp > numByteOrig) {
-            cout << "File will not compress" << endl;
+        if (!dest.open(oFileName)) {
+            msg << "Could not open " << oFileName << endl;
             return 0;
         }
-        
-        //starting encoding
-        int mapSize = charMap.size(); //represents size of our character map
-        //open binary file, write magic num and number of characters
-        outputFile.open(oFileName, ios::out | ios::binary);
-        outputFile.write((char*)&magicNum, sizeof(magicNum));
-        outputFile.write((char*)&mapSize, sizeof(mapSize));
-        
-        //write huffman tree
-        itr = charMap.begin();
-        
-        //write each character and its frequency to the binary file
-        while (itr != charMap.end()) {
-            outputFile.write((char*)&(itr->first), sizeof(itr->first));
-            outputFile.write((char*)&(itr->second), sizeof(itr->second));
-            
-            itr++;
-        }
-
-        //read from original file again
-        myFile.open(iFileName);
-        string encodString = ""; //string variable used to represent the bytes we read from
-        //the file. It will be used to write bytes to the file
-        
-        //write to compression file
-        while (myFile.get(ch)) {
-            //get the encoding for our character
-            map<char, string>::iterator itr4 = encodeTable.find(ch);
-            string chEncode = (*itr4).second;
-
-            //if our encoding is greater than 8 characters long, split it and write
-            //the first 8 to the binary file
-            while ( encodString.size() >= 8) {
-                string tempString = encodString.substr(8); //represents rest of string
-                //after we cut it
-                encodString = encodString.substr(0, 8); //repesents first 8 characters of string
-                
-                //convert string to byte and write it to file
-                myByte = convertToByte(encodString);
-                outputFile.write((char*)&(myByte), sizeof(myByte));
-                encodString = tempString;
+
+        vector<huff_decoder> decoders(window); //decoder of each block in the window
+        vector<string> decoded(window); //decoded blocks of a window
+        vector<vector<char> > buffers(window); //buffers for blocks that are
+        //read instead of mapped, each is reused for every window
+        vector<const unsigned char*> blocks(window); //blocks of the window,
+        //after their length fields
+        vector<size_t> blockLens(window); //length of each block after its length field
+        vector<unsigned char> lengths((window + 1) * 256); //code lengths of
+        //the block before the window, then of each block in the window
+        vector<char> lenBuf; //holds a length field if it can't be mapped
+        atomic<bool> valid(true); //false once a block fails to decode
+        bool missingTable = false; //true if a block needs a table that wasn't given
+        uint64_t numByteDecoded = 0; //number of bytes written to the destination
+
+        for (size_t i = 0; i < window; i++) {
+            decoders[i].sharedTable = sharedTable;
+            if (showStats) {
+                decoders[i].stats = &slotStats[i];
             }
-            
-            //if size is less than 8, add them
-            if ( (encodString.size() + chEncode.size()) <= 8) {
-                encodString = encodString + chEncode;
-                
-                //if its equal to 8, write it
-                if (encodString.size() == 8) {
-                    myByte = convertToByte(encodString);
-                    outputFile.write((char*)&(myByte), sizeof(myByte));
-                    encodString = "";
+        }
+
+        //original encoding, the whole file is one stream
+        if (firstNum == legacyMagicNum) {
+            vector<char> restBuf; //holds the rest of the file if it can't be mapped
+            uint64_t restLen; //number of bytes after the header
+            phase = chrono::steady_clock::now();
+            const unsigned char* rest = source.all(restBuf, restLen); //the rest of the file
+            vector<unsigned char> file(header, header + headerLen); //the whole file
+            file.insert(file.end(), rest, rest + restLen);
+            numByteComp += restLen;
+            stats.readSeconds += secondsSince(phase);
+
+            phase = chrono::steady_clock::now();
+            valid = decoders[0].decodeLegacy(file.data(), file.size(), decoded[0]);
+            stats.encodeSeconds += secondsSince(phase);
+            dest.write(decoded[0].data(), decoded[0].size());
+            numByteDecoded += decoded[0].size();
+        }
+
+        //canonical encoding, read a window of blocks in order until the zero
+        //block length, decode them together and write them in order
+        bool more = firstNum == canonMagicNum; //false once the end mark is read
+        bool first = true; //true until a block has been read
+        bool singleBlock = firstNum == canonMagicNum && (header[5] & singleBlockFlag); //true
+        //if the file holds one block and no end mark
+        while (more && valid) {
+            size_t count = 0; //number of blocks read into this window
+            phase = chrono::steady_clock::now();
+            while (count < window && more) {
+                size_t got; //number of bytes read
+                uint32_t blockLen = 0; //length of the block after its length field
+                const char* field = source.next(sizeof(blockLen), lenBuf, got); //the length field
+                if (got < sizeof(blockLen)) {
+                    valid = false;
+                    break;
+                }
+                memcpy(&blockLen, field, sizeof(blockLen));
+                numByteComp += got;
+                if (blockLen == 0) {
+                    more = false;
+                    break;
+                }
+
+                blocks[count] = (const unsigned char*)source.next(blockLen, buffers[count], got);
+                blockLens[count] = got;
+                numByteComp += got;
+
+                //the code lengths are followed here, so blocks that reuse
+                //the lengths of the block before can be decoded in parallel
+                const unsigned char* prev = first ? NULL : &lengths[count * 256]; //lengths
+                //of the block before
+                if (got < blockLen || !readBlockLengths(blocks[count], got, prev, sharedTable,
+                                                        &lengths[(count + 1) * 256])) {
+                    missingTable = reportMissingTable(blocks[count], got, sharedTable, msg);
+                    valid = false;
+                    break;
                 }
+                first = false;
+                count++;
+                more = !singleBlock;
             }
-            
-            //if combined size is greater than 8, cut it and write first 8 characters to file
-            else if ( (encodString.size() + chEncode.size()) > 8) {
-                for (int i = 0; i < chEncode.size(); i++) {
-                    string str2 = chEncode.substr(0, i);
-                    
-                    if ( (encodString.size() + str2.size()) == 8) {
-                        encodString = encodString + str2;
-                        myByte = convertToByte(encodString);
-                        string str3 = chEncode.substr(i); //temp string used to rest of string
-                        //after we cut it
-                        outputFile.write((char*)&(myByte), sizeof(myByte));
-                        encodString = str3;
-                        str3 = "";
-                        str2 = "";
-                        break;
-                    }
+            stats.readSeconds += secondsSince(phase);
+
+            pool.run(count, [&](size_t i) {
+                decoded[i].clear();
+                if (!decoders[i].decodeBlock(blocks[i], blockLens[i], decoded[i], &lengths[i * 256])) {
+                    valid = false;
                 }
+            });
+
+            phase = chrono::steady_clock::now();
+            for (size_t i = 0; i < count && valid; i++) {
+                dest.write(decoded[i].data(), decoded[i].size());
+                numByteDecoded += decoded[i].size();
             }
-            
-            
-        }
-        myByte = 0; //reset byte
-
-        //write eof character to file
-        string eofString = encodeTable[eofChar]; //string to represent the eof character
-        //if we can add it onto the current byte string, write it to file
-        if (encodString.size() + eofString.size() == 8) {
-            encodString = encodString.size() + eofString.size();
-            myByte = convertToByte(encodString);
-            outputFile.write((char*)&(myByte), sizeof(myByte));
-        }
-        //if it will be less than 8, add zeros onto the end of the byte
-        else if ( (encodString.size() + eofString.size()) < 8) {
-            encodString = encodString.size() + eofString.size();
-            
-            while (encodString.size() < 8) {
-                encodString.append("0");
+            if (count != 0) {
+                memcpy(&lengths[0], &lengths[count * 256], 256);
             }
-            
-            myByte = convertToByte(encodString);
-            outputFile.write((char*)&(myByte), sizeof(myByte));
-        }
-        //if it will be greater than 8, split it into two string
-        else if (encodString.size() + eofString.size() > 8 ) {
-            for (int i = 0; i < eofString.size(); i++) {
-                string str2 = eofString.substr(0, i);
-                
-                if ( (encodString.size() + str2.size()) == 8) {
-                    encodString = encodString + str2;
-                    string str3 = eofString.substr(i); //temporary string to store other half
-                    myByte = convertToByte(encodString);
-                    outputFile.write((char*)&(myByte), sizeof(myByte));
-                    //if it's less than 8, add zeroes to make it byte size
-                    while (str3.size() < 8) {
-                        str3.append("0");
-                    }
-                    myByte = convertToByte(str3);
-                    outputFile.write((char*)&(myByte), sizeof(myByte));
-                    break;
-                }
+            stats.flushSeconds += secondsSince(phase);
+        }
+
+        //the block offsets after the end mark are only needed for seeking,
+        //but a pipe is drained so the writer doesn't see it close early
+        if (valid) {
+            vector<char> restBuf; //holds the rest of the file if it can't be mapped
+            uint64_t restLen = 0; //number of bytes after the end mark
+            if (firstNum == canonMagicNum) {
+                source.all(restBuf, restLen);
             }
+            numByteComp += restLen;
+        }
+
+        phase = chrono::steady_clock::now();
+        if (!dest.close()) {
+            msg << "Could not write " << oFileName << endl;
+        }
+        else if (!valid && !missingTable) {
+            msg << "Input file was not Huffman Endoded." << endl;
+        }
+        else if (showStats) {
+            stats.flushSeconds += secondsSince(phase);
+            stats.bytesIn = numByteComp;
+            stats.bytesOut = numByteDecoded;
+            reportStats(stats, slotStats, start);
         }
-        
-        //close the files
-        myFile.close();
-        outputFile.close();
     }
-    
-    
-    
-    //UNHUFF
-    //reading decompressed file
-    else if (command == "-unhuff") {
-        outputFile.open(iFileName, ios::in | ios::binary);
-        int firstNum; //variable to read the first number
-        int numLets; //variable to read number of characters
-        char chaa; //temporary character to store read letters
-        int freqq; //temporary int to read frequency
-        map<string, char> dencodeTable; //map used to hold encoding
-        //with the encoding string as the key
-        
-        //read the magic number, see if it matches
-        outputFile.read((char*)&firstNum, sizeof(firstNum));
-        
-        //if it doesn't match, end the program.
-        if (firstNum != magicNum) {
-            cout << "Input file was not Huffman Endoded." << endl;
+
+
+    //decompress only a range of the source, through the seek index
+    else if (command == "-extract") {
+        input_file source; //the binary file, mapped when possible
+        output_file dest; //the destination file
+        vector<char> sourceBuf; //holds the binary file if it can't be mapped
+        uint64_t fileSize = 0; //number of bytes in the binary file
+        huff_decoder decoder; //decodes the blocks of the range
+        string decoded; //the range
+
+        if (!source.open(iFileName)) {
+            msg << "Could not open " << iFileName << endl;
             return 0;
         }
-        
-         
-        //read in number of characters
-        outputFile.read((char*)&numLets, sizeof(numLets));
+        decoder.stats = &stats;
+        decoder.sharedTable = sharedTable;
+        phase = chrono::steady_clock::now();
+        const unsigned char* file = source.all(sourceBuf, fileSize); //the binary file
+        stats.readSeconds += secondsSince(phase);
 
-        //read in each character and its frequency, put it into a map
-        for (int i = 0; i < numLets; i++) {
-            outputFile.read((char*)&chaa, sizeof(chaa));
-            outputFile.read((char*)&freqq, sizeof(freqq));
-            charMap.insert(pair<char, int>(chaa, freqq));
+        //a file written with a shared table uses it from the first block
+        if (!decoder.extract(file, fileSize, extractOffset, extractLength, decoded)) {
+            if (fileSize <= fileHeaderSize + 4 ||
+                !reportMissingTable(file + fileHeaderSize + 4, fileSize - fileHeaderSize - 4,
+                                    sharedTable, msg)) {
+                msg << "Input file was not Huffman Endoded." << endl;
+            }
+            return 0;
         }
-        
-        
-        map<char, int>::iterator itr = charMap.begin(); //iterator variable to iterate
-                                                         //through map
-        
-        //add nodes to priority queue to create Huffman tree
-        while (itr != charMap.end()) {
-            p = new node();
-            p->c = itr->first;
-            p->count = itr->second;
-            n.push(p);
-            
-            itr++;
+        if (!dest.open(oFileName)) {
+            msg << "Could not open " << oFileName << endl;
+            return 0;
         }
-        
-        
-        node *n3, *n4; //temporary node variables used to create huffman tree
-        
-        //create huffman tree by combining nodes with smallest values
-        while (n.size() > 1) {
-            n3 = n.top();
-            n.pop();
-            
-            n4 = n.top();
-            n.pop();
-            p = new node(n3, n4);
-            n.push(p);
+        phase = chrono::steady_clock::now();
+        dest.write(decoded.data(), decoded.size());
+        if (!dest.close()) {
+            msg << "Could not write " << oFileName << endl;
         }
-        
-        //reset string and create dencodeTable
-        dencodeTable.clear();
-        dencodeData(p, "", dencodeTable);
-        
-        
-        //unsigned char myByte = 0; //
-        string byteString; //create temporary string to represent bytes
-        string readingString; //create string that represents current reading of
-                              //the encoding
-        //read the first byte character from the file
-        //and convert it to a string
-        outputFile.read((char*)&myByte, sizeof(myByte));
-        byteString = byteToString(myByte);
-        
-        
-        //open the destination file
-        finalFile.open(oFileName);
-        
-        //read the encryption and convert it to characters to write to output file
-        while (ch != eofChar) {
-            //add bytestring to readingstring, see if we encounter a letter
-            for (int i = 0; i < byteString.size(); i++) {
-                readingString = readingString + byteString[i];
-                
-                if (dencodeTable.find(readingString) != dencodeTable.end()) {
-                    ch = dencodeTable[readingString];
-                    if (ch == eofChar) {
-                        break;
-                    }
-                    //output the character to the file, reset string
-                    finalFile << ch;
-                    readingString = "";
-                }
-            }
-            
-            //end if eof character
-            if (ch == eofChar) {
-                break;
-            }
-            
-            //reset string, read next byte, convert it to string
-            byteString = "";
-            outputFile.read((char*)&myByte, sizeof(myByte));
-            byteString = byteToString(myByte);
+        else if (showStats) {
+            stats.flushSeconds += secondsSince(phase);
+            stats.bytesIn = fileSize;
+            stats.bytesOut = decoded.size();
+            reportStats(stats, slotStats, start);
         }
-        
-        //close both files
-        finalFile.close();
-        outputFile.close();
     }
 
-    
     return 0;
 }